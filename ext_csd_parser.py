@@ -22,6 +22,9 @@ def parse(ext_csd_bytes):
     sec_count = unpack("<I", ext_csd_bytes[212:216])[0]  # SEC_COUNT
     ext_csd_rev = ext_csd_bytes[192]  # EXT_CSD_REV
     card_type = ext_csd_bytes[196]  # CARD_TYPE
+    hc_erase_grp_size = ext_csd_bytes[224]  # HC_ERASE_GRP_SIZE
+    sec_feature = ext_csd_bytes[231]  # SEC_FEATURE_SUPPORT
+    erased_mem_cont = ext_csd_bytes[181]  # ERASED_MEM_CONT
 
     # Calculate sizes
     boot_size_kb = boot_mult * 128  # Boot partition size in KiB
@@ -33,6 +36,11 @@ def parse(ext_csd_bytes):
         'boot_size_mult': boot_mult,
         'boot_sectors': boot_sectors,
         'sec_count': sec_count,
+        'erase_group_sectors': hc_erase_grp_size * 1024,  # 512 KiB units
+        'trim_supported': bool(sec_feature & 0x10),  # SEC_GB_CL_EN
+        'secure_erase_supported': bool(sec_feature & 0x01),  # SEC_ER_EN
+        'discard_supported': ext_csd_rev >= 6,  # eMMC 4.5+
+        'erased_byte': 0xFF if erased_mem_cont else 0x00,
         'regions': {
             'boot0': boot_sectors,
             'boot1': boot_sectors,
@@ -48,6 +56,11 @@ def print_summary(info):
     print(f"  Card Type: 0x{info['card_type']:02x}")
     print(f"  BOOT_SIZE_MULT: {info['boot_size_mult']} (each boot partition: {info['boot_sectors']} sectors)")
     print(f"  SEC_COUNT: {info['sec_count']} sectors")
+    print(f"  Erase group: {info['erase_group_sectors']} sectors "
+          f"(TRIM {'yes' if info['trim_supported'] else 'no'}, "
+          f"DISCARD {'yes' if info['discard_supported'] else 'no'}, "
+          f"secure erase {'yes' if info['secure_erase_supported'] else 'no'}, "
+          f"erased data 0x{info['erased_byte']:02x})")
     print(f"\nRegion Sizes:")
     for region, sectors in info['regions'].items():
         size_mb = (sectors * 512) / (1024 * 1024)
@@ -37,6 +37,28 @@ COMMANDS:
         Low-level sector write to eMMC regions.
         Validates bounds before writing. Use with caution on boot partitions.
 
+    write-scattered
+        Write several small files at unrelated LBAs (GPT, boot records,
+        filesystem metadata). Batched into eMMC packed write commands.
+
+    read-scattered
+        Read several LBA ranges into separate files. Queued on the eMMC
+        command queue so the card can reorder them; sequential otherwise.
+
+    erase
+        Erase, trim or discard sectors on the device (CMD35/36/38) instead of
+        writing zeros. Takes a region range or a userdata partition label.
+
+    reboot
+        Flush the eMMC write cache and reboot the device.
+
+    bench-usb
+        Time range reads at several USB transfer units (bytes per BROM
+        USB call) and report the fastest, to pass as --usb-chunk.
+
+    stats
+        Show device-side driver counters (e.g. discard reads issued).
+
 USAGE EXAMPLES:
     # Dump and display EXT_CSD information
     python3 mt8113_reflash.py dump-extcsd
@@ -59,11 +81,52 @@ USAGE EXAMPLES:
     # Write data to userdata starting at sector 1000
     python3 mt8113_reflash.py write --region userdata --start 1000 --input data.bin
 
+    # Same read, with the device moving multi-block data by DMA instead of PIO
+    python3 mt8113_reflash.py --xfer-mode dma read --region boot0 --start 0 --length 1024 --output boot0_backup.bin
+
+    # Let the controller send CMD23/CMD12 around multi-block transfers
+    # (only with stage2 built with EMMC_AUTO_CMD_ALLOW, unverified on MT8113)
+    python3 mt8113_reflash.py --auto-cmd both --xfer-mode dma read --region boot0 --start 0 --length 1024 --output boot0_backup.bin
+
+    # Write with the eMMC cache on, flushed once at the end of the write
+    python3 mt8113_reflash.py --cache write-partition --label recovery --input recovery.img
+
+    # Write a GPT and an environment block in packed batches
+    python3 mt8113_reflash.py write-scattered --at 0:gpt_head.bin --at 0x4000:env.bin
+
+    # Read a GPT header and an environment block as one queued batch
+    python3 mt8113_reflash.py read-scattered --at 1:1:gpt_head.bin --at 0x4000:16:env.bin
+
+    # Wipe a partition with erase commands (far faster than writing zeros)
+    python3 mt8113_reflash.py erase --label userdata
+
+    # Discard a sector range of boot1
+    python3 mt8113_reflash.py erase --region boot1 --start 0 --length 0 --type discard
+
+    # Find the fastest USB transfer unit for this board, then use it
+    python3 mt8113_reflash.py bench-usb
+    python3 mt8113_reflash.py --usb-chunk 32768 read-partition --label rootfs --output rootfs.img
+
+    # Same, with stage2's own USB bulk driver instead of the BROM routines
+    python3 mt8113_reflash.py --native-usb read-partition --label rootfs --output rootfs.img
+
+    # Check that sequential reads no longer need discard reads
+    python3 mt8113_reflash.py stats
+
+    # Reuse HS200/HS400 tuning taps from an earlier session (file is created on first run)
+    python3 mt8113_reflash.py --tuning tuning.json read-gpt
+
+    # Stay at DDR52 if HS200 is unreliable on this board
+    python3 mt8113_reflash.py --max-timing ddr52 read-gpt
+
 """
 
 import argparse
+import json
 import os
+import queue
 import sys
+import threading
 import time
 from struct import pack, unpack
 import usb.core
@@ -80,6 +143,87 @@ REGIONS = {
     'userdata': 0  # EMMC_PART_USER
 }
 
+# Multi-block transfer modes (from mt8113_emmc.h)
+XFER_MODES = {
+    'pio': 1,       # EMMC_XFER_PIO
+    'dma': 2,       # EMMC_XFER_DMA_BASIC
+    'dma-desc': 3   # EMMC_XFER_DMA_DESC
+}
+
+# Auto commands for multi-block transfers (EMMC_AUTO_CMD* flags in mt8113_emmc.h)
+AUTO_CMDS = {
+    'none': 0,      # EMMC_AUTO_CMD_NONE
+    'cmd12': 1,     # EMMC_AUTO_CMD12
+    'cmd23': 2,     # EMMC_AUTO_CMD23
+    'both': 3       # CMD23 where possible, CMD12 otherwise
+}
+
+# CMD38 erase variants (EMMC_ERASE_* in mt8113_emmc.h)
+ERASE_TYPES = {
+    'erase': 0x00000000,    # EMMC_ERASE_NORMAL
+    'trim': 0x00000001,     # EMMC_ERASE_TRIM
+    'discard': 0x00000003,  # EMMC_ERASE_DISCARD
+    'secure': 0x80000000    # EMMC_ERASE_SECURE
+}
+
+# Sectors per erase request; the device splits further and waits out the
+# card's busy time, so each request gets a long status timeout
+ERASE_STEP_SECTORS = 1 << 21  # 1 GiB
+ERASE_TIMEOUT_MS = 300000
+
+# FLUSH_CACHE has no spec bound; the device allows 30 s, leave it room
+FLUSH_TIMEOUT_MS = 40000
+
+# Packed write / queued batch limits (EMMC_PACKED_MAX_ENTRIES,
+# EMMC_CMDQ_MAX_TASKS, BATCH_BUF_SECTORS in stage2)
+PACKED_MAX_ENTRIES = 63
+CMDQ_MAX_TASKS = 32
+BATCH_BUF_SECTORS = 64
+
+# USB transfer unit (bytes per usbdl_put_data/usbdl_get_data call on the
+# device). The device starts at USBDL_CHUNK_SIZE and clamps requests to
+# USBDL_CHUNK_MAX, one batch buffer.
+USB_CHUNK_DEVICE_DEFAULT = 256
+USB_CHUNK_MAX = BATCH_BUF_SECTORS * 512
+BENCH_CHUNK_SIZES = [256, 512, 1024, 2048, 4096, 8192, 16384, 32768]
+
+# The device waits USBDL_PROBE_TIMEOUT_MS for the echoed test pattern
+USB_PROBE_TIMEOUT_MS = 2000
+
+# Streaming write (0x1021): the device acks every STREAM_ACK_SECTORS, and
+# the host runs at most STREAM_WINDOW acks ahead of the last one it got
+STREAM_ACK_SECTORS = 4 * BATCH_BUF_SECTORS
+STREAM_WINDOW = 4
+STREAM_WRITE_TIMEOUT_MS = 10000
+
+# Bus timing limits (from mt8113_emmc.h)
+TIMINGS = {
+    'legacy': 0,    # EMMC_TIMING_LEGACY
+    'hs': 1,        # EMMC_TIMING_HS
+    'ddr52': 2,     # EMMC_TIMING_DDR52
+    'hs200': 3,     # EMMC_TIMING_HS200
+    'hs400': 4,     # EMMC_TIMING_HS400
+    'hs400es': 5    # EMMC_TIMING_HS400ES
+}
+
+# Driver counters in the order the device reports them (struct emmc_stats)
+STATS_FIELDS = [
+    'discard_reads',
+    'cmd13_sent',
+    'cmd13_skipped',
+    'ext_csd_hits',
+    'ext_csd_fetches',
+    'auto_cmd_sent',
+    'auto_cmd_errors',
+    'cache_flushes',
+    'packed_batches',
+    'cmdq_tasks',
+    'pipe_emmc_bound',
+    'pipe_host_bound',
+    'pipe_wait_ticks',
+    'busy_deferred',
+]
+
 
 class MT8113USB:
     """USB communication layer for MT8113 device"""
@@ -93,6 +237,7 @@ class MT8113USB:
         self.ep_out = None
         self.ep_in = None
         self.current_region = None  # Track current region to avoid unnecessary switches
+        self.xfer_size = USB_CHUNK_DEVICE_DEFAULT  # Agreed USB transfer unit
 
     def connect(self):
         """Find and configure USB device"""
@@ -133,18 +278,48 @@ class MT8113USB:
         #print(f"Endpoints: OUT={self.ep_out.bEndpointAddress:02x}, IN={self.ep_in.bEndpointAddress:02x}")
         print("Connected successfully")
 
-    def usbwrite(self, data):
-        """Write data to USB device"""
+    def usbwrite(self, data, timeout=None):
+        """Write data to USB device, in pieces of the agreed transfer unit"""
         if isinstance(data, int):
             data = pack(">I", data)  # Big-endian for protocol
-        self.ep_out.write(data)
-
-    def usbread(self, size):
+        step = max(self.xfer_size, 512)
+        for i in range(0, len(data), step):
+            self.ep_out.write(data[i:i + step], timeout=timeout)
+
+    def native_usb(self):
+        """Have stage2 drive the bulk endpoints itself instead of the BROM
+
+        Returns False if the device kept the BROM routines.
+        """
+        self.send_command(0x1031)
+        return unpack("<I", self.usbread(4))[0] == 0xD0D0D0D0
+
+    def set_xfer_size(self, size):
+        """Agree on the USB transfer unit; returns the size the device kept
+
+        The device tries the clamped size on a test pattern we echo back,
+        and stays at its previous unit if that doesn't come back intact or
+        in time. A transfer that fails here is left to the device timeout.
+        """
+        self.send_command(0x1030, min(size, USB_CHUNK_MAX))
+        tried = unpack(">I", self.usbread(4))[0]
+        self.xfer_size = tried
+        try:
+            pattern = self.usbread((tried + 511) & ~511, timeout=USB_PROBE_TIMEOUT_MS)
+            self.usbwrite(pattern, timeout=USB_PROBE_TIMEOUT_MS)
+        except (RuntimeError, usb.core.USBError) as e:
+            print(f"Warning: {tried}-byte test transfer failed: {e}")
+        self.xfer_size = unpack(">I", self.usbread(4, timeout=2 * USB_PROBE_TIMEOUT_MS))[0]
+        if self.xfer_size != tried:
+            print(f"Warning: device failed {tried}-byte transfers, kept {self.xfer_size}")
+        return self.xfer_size
+
+    def usbread(self, size, timeout=5000):
         """Read data from USB device, accumulating chunks until size is reached"""
         try:
             data = bytearray()
             while len(data) < size:
-                chunk = self.ep_in.read(size - len(data), timeout=5000)
+                chunk = self.ep_in.read(size - len(data), timeout=timeout)
                 data.extend(chunk)
             return bytes(data)
         except usb.core.USBError as e:
@@ -171,8 +346,92 @@ class MT8113USB:
             raise RuntimeError(f"Expected 512 bytes, got {len(data)}")
         return data
 
+    def read_stream(self, region_id, start_sector, num_sectors, chunk_sectors=BATCH_BUF_SECTORS):
+        """Read a sector range with one command, yielding it in chunks
+
+        The device streams every sector back without further handshakes,
+        then a status word. Raises once the stream ends if it reported an
+        error (the failed part arrives as zeros).
+        """
+        self.send_command(0x1020, region_id, start_sector, num_sectors)
+        remaining = num_sectors
+        while remaining:
+            n = min(chunk_sectors, remaining)
+            yield self.usbread(n * 512)
+            remaining -= n
+        status = unpack("<I", self.usbread(4))[0]
+        if status != 0xD0D0D0D0:
+            raise RuntimeError(f"Range read of sectors {start_sector}-{start_sector + num_sectors - 1} failed")
+
+    def read_sectors(self, region_id, start_sector, num_sectors):
+        """Read a sector range into memory"""
+        return b''.join(self.read_stream(region_id, start_sector, num_sectors))
+
+    def write_stream(self, region_id, start_sector, num_sectors, chunks,
+                     ack_sectors=STREAM_ACK_SECTORS, window=STREAM_WINDOW):
+        """Write a sector range with one command, from an iterable of data
+
+        chunks must add up to num_sectors * 512 bytes. Data goes out without
+        waiting for each ack; a background thread collects the device's
+        acks (every ack_sectors) so neither side stalls on the other.
+        Yields the number of sectors the device has confirmed so far and
+        raises on the first ack that reports an error.
+        """
+        n_acks = (num_sectors + ack_sectors - 1) // ack_sectors
+        acks = queue.Queue()
+
+        def ack_reader():
+            try:
+                for _ in range(n_acks):
+                    marker, status = unpack("<II", self.usbread(8, timeout=STREAM_WRITE_TIMEOUT_MS))
+                    fail_lba = unpack(">I", self.usbread(4))[0]
+                    if marker != 0xA0A0A0A0:
+                        raise RuntimeError(f"Bad stream ack marker 0x{marker:08x}")
+                    acks.put((status, fail_lba))
+            except Exception as e:
+                acks.put(e)
+
+        self.send_command(0x1021, region_id, start_sector, num_sectors, ack_sectors)
+        reader = threading.Thread(target=ack_reader, daemon=True)
+        reader.start()
+
+        sent = acked = 0
+        failed = None
+
+        def take_ack():
+            nonlocal acked, failed
+            ack = acks.get()
+            if isinstance(ack, Exception):
+                raise ack
+            status, fail_lba = ack
+            acked = min(acked + ack_sectors, num_sectors)
+            if status != 0xD0D0D0D0 and failed is None:
+                failed = fail_lba
+
+        for data in chunks:
+            # Past an error the device only drops data, send zeros instead
+            if failed is not None:
+                data = bytes(len(data))
+            for i in range(0, len(data), ack_sectors * 512):
+                while sent - acked >= window * ack_sectors:
+                    take_ack()
+                    if failed is None:
+                        yield acked
+                piece = data[i:i + ack_sectors * 512]
+                self.usbwrite(piece, timeout=STREAM_WRITE_TIMEOUT_MS)
+                sent += len(piece) // 512
+        if sent != num_sectors:
+            raise RuntimeError(f"Stream data was {sent} sectors, expected {num_sectors}")
+        while acked < num_sectors:
+            take_ack()
+            if failed is None:
+                yield acked
+        reader.join()
+        if failed is not None:
+            raise RuntimeError(f"Write failed in the chunk starting at sector {failed}")
+
     def write_sector(self, region_id, sector_num, data):
-        """Write single 512-byte sector to specified region"""
+        """Write single 512-byte sector to specified region; needs a flush_cache() after"""
         if len(data) != 512:
             raise ValueError(f"Data must be exactly 512 bytes, got {len(data)}")
 
@@ -187,6 +446,126 @@ class MT8113USB:
         response_val = unpack("<I", response)[0]
         return response_val == 0xD0D0D0D0
 
+    def erase(self, region_id, start_sector, num_sectors, erase_type):
+        """Erase a sector range on the device (ERASE_TYPES value)"""
+        self.send_command(0x1010, region_id, start_sector, num_sectors, erase_type)
+        response = self.usbread(4, timeout=ERASE_TIMEOUT_MS)
+        response_val = unpack("<I", response)[0]
+        return response_val == 0xD0D0D0D0
+
+    def write_packed(self, region_id, entries):
+        """Write [(sector, data), ...] as one packed batch, data a multiple of 512 bytes
+
+        Returns (ok, failing entry index or 0)
+        """
+        args = [region_id, len(entries)]
+        for sector, data in entries:
+            args += [sector, len(data) // 512]
+        self.send_command(0x1013, *args)
+        for _, data in entries:
+            for i in range(0, len(data), 512):
+                self.usbwrite(data[i:i + 512])
+        status, fail_index = unpack("<I", self.usbread(4))[0], unpack(">I", self.usbread(4))[0]
+        return status == 0xD0D0D0D0, fail_index
+
+    def run_queue(self, region_id, tasks, write):
+        """Run [(sector, count or data), ...] as one command queue batch
+
+        Reads come back in whatever order the card ran them. Returns
+        (ok, failing task index or 0, {task index: data} for reads)
+        """
+        args = [region_id, len(tasks)]
+        for sector, arg in tasks:
+            args += [1 if write else 0, sector, len(arg) // 512 if write else arg]
+        self.send_command(0x1014, *args)
+        if write:
+            for _, data in tasks:
+                for i in range(0, len(data), 512):
+                    self.usbwrite(data[i:i + 512])
+        results = {}
+        while True:
+            index = unpack(">I", self.usbread(4))[0]
+            if index == 0xFFFFFFFF:
+                break
+            results[index] = self.usbread(tasks[index][1] * 512)
+        status, fail_index = unpack("<I", self.usbread(4))[0], unpack(">I", self.usbread(4))[0]
+        return status == 0xD0D0D0D0, fail_index, results
+
+    def set_cache(self, enable):
+        """Turn the eMMC volatile write cache on or off"""
+        self.send_command(0x1011, 1 if enable else 0)
+        response = self.usbread(4, timeout=FLUSH_TIMEOUT_MS)
+        response_val = unpack("<I", response)[0]
+        return response_val == 0xD0D0D0D0
+
+    def flush_cache(self):
+        """Commit cached writes to flash (no-op on the device if the cache is off)
+
+        Sent after every write, whether or not this run enabled the cache:
+        the device keeps it on across host runs.
+        """
+        self.send_command(0x1012)
+        response = self.usbread(4, timeout=FLUSH_TIMEOUT_MS)
+        response_val = unpack("<I", response)[0]
+        return response_val == 0xD0D0D0D0
+
+    def reboot(self):
+        """Flush the write cache, then reset the SoC through the watchdog"""
+        if not self.flush_cache():
+            raise RuntimeError("Cache flush before reboot failed")
+        self.send_command(0x3000)
+
+    def set_xfer_mode(self, mode):
+        """Select how the device moves multi-block data (XFER_MODES value)"""
+        self.send_command(0x1004, mode)
+        response = self.usbread(4)
+        response_val = unpack("<I", response)[0]
+        return response_val == 0xD0D0D0D0
+
+    def set_auto_cmd(self, flags):
+        """Let the controller issue CMD12/CMD23 itself (AUTO_CMDS value)"""
+        self.send_command(0x1009, flags)
+        response = self.usbread(4)
+        response_val = unpack("<I", response)[0]
+        return response_val == 0xD0D0D0D0
+
+    def init_emmc(self):
+        """Re-run eMMC init on the device (applies timing limit and taps)"""
+        self.send_command(0x1000)
+        response = self.usbread(4)
+        response_val = unpack("<I", response)[0]
+        return response_val == 0xD1D1D1D1
+
+    def set_max_timing(self, timing):
+        """Cap the bus timing selected by the next init (TIMINGS value)"""
+        self.send_command(0x1007, timing)
+        response = self.usbread(4)
+        response_val = unpack("<I", response)[0]
+        return response_val == 0xD0D0D0D0
+
+    def get_tuning(self):
+        """Return the device's HS200/HS400 tuning taps as a dict"""
+        self.send_command(0x1005)
+        valid, timing, cmd_dly, dat_dly, ds_dly = unpack(">5I", self.usbread(20))
+        return {'valid': valid, 'timing': timing, 'cmd_dly': cmd_dly, 'dat_dly': dat_dly,
+                'ds_dly': ds_dly}
+
+    def set_tuning(self, tuning):
+        """Hand saved tuning taps to the device for its next init"""
+        self.send_command(0x1006, tuning['valid'], tuning['timing'],
+                          tuning['cmd_dly'], tuning['dat_dly'], tuning.get('ds_dly', 0))
+        response = self.usbread(4)
+        response_val = unpack("<I", response)[0]
+        return response_val == 0xD0D0D0D0
+
+    def get_stats(self):
+        """Return the device's driver counters as a dict"""
+        self.send_command(0x1008)
+        count = unpack(">I", self.usbread(4))[0]
+        values = unpack(f">{count}I", self.usbread(4 * count)) if count else ()
+        names = STATS_FIELDS + [f'field{i}' for i in range(len(STATS_FIELDS), count)]
+        return dict(zip(names, values))
+
     def get_ext_csd(self):
         """Retrieve 512-byte EXT_CSD register from device"""
         self.send_command(0x1003)
@@ -213,6 +592,33 @@ def get_and_save_ext_csd(usb, output_file='ext_csd.bin'):
     return info
 
 
+def apply_timing_options(usb, max_timing, tuning_file):
+    """Apply --max-timing / --tuning, re-init, and save newly found taps"""
+    if max_timing is not None:
+        if not usb.set_max_timing(TIMINGS[max_timing]):
+            raise RuntimeError(f"Device rejected timing '{max_timing}'")
+        print(f"Max timing: {max_timing}")
+
+    if tuning_file and os.path.exists(tuning_file):
+        with open(tuning_file, 'r') as f:
+            tuning = json.load(f)
+        if not usb.set_tuning(tuning):
+            raise RuntimeError("Device rejected saved tuning")
+        print(f"Loaded tuning from {tuning_file}: cmd={tuning['cmd_dly']} dat={tuning['dat_dly']} ds={tuning.get('ds_dly', 0)}")
+
+    if not usb.init_emmc():
+        raise RuntimeError("eMMC re-init failed")
+
+    if tuning_file:
+        tuning = usb.get_tuning()
+        if tuning['valid']:
+            with open(tuning_file, 'w') as f:
+                json.dump(tuning, f, indent=2)
+            print(f"Saved tuning to {tuning_file}: cmd={tuning['cmd_dly']} dat={tuning['dat_dly']} ds={tuning.get('ds_dly', 0)}")
+        else:
+            print("Device did not tune (HS200/HS400 not in use), tuning file left as is")
+
+
 def read_flash(usb, region, start_sector, num_sectors, output_file, region_sizes):
     """Read sectors from eMMC region to file"""
     region_id = REGIONS[region]
@@ -237,15 +643,14 @@ def read_flash(usb, region, start_sector, num_sectors, output_file, region_sizes
     bytes_per_sector = 512
 
     with open(output_file, 'wb') as f:
-        for i in range(num_sectors):
-            sector_num = start_sector + i
-            data = usb.read_sector(region_id, sector_num)
+        sectors_done = 0
+        for data in usb.read_stream(region_id, start_sector, num_sectors):
             f.write(data)
+            sectors_done += len(data) // 512
 
             # Progress display with speed and ETA
             elapsed = time.time() - start_time
-            if elapsed > 0 and (i % 10 == 0 or i == num_sectors - 1):  # Update every 10 sectors
-                sectors_done = i + 1
+            if elapsed > 0:
                 speed_sectors_per_sec = sectors_done / elapsed
                 speed_mbps = (speed_sectors_per_sec * bytes_per_sector) / (1024 * 1024)
                 remaining_sectors = num_sectors - sectors_done
@@ -260,6 +665,17 @@ def read_flash(usb, region, start_sector, num_sectors, output_file, region_sizes
     print(f"Read complete: {num_sectors} sectors in {elapsed_total:.1f}s (avg {avg_speed:.2f} MB/s)")
 
 
+def file_chunks(f, chunk_size=STREAM_ACK_SECTORS * 512):
+    """Read a file in chunks, padding the last one to a whole sector"""
+    while True:
+        data = f.read(chunk_size)
+        if not data:
+            break
+        if len(data) % 512:
+            data += b'\x00' * (512 - len(data) % 512)
+        yield data
+
+
 def write_flash(usb, region, start_sector, input_file, region_sizes):
     """Write sectors from file to eMMC region"""
     region_id = REGIONS[region]
@@ -284,26 +700,10 @@ def write_flash(usb, region, start_sector, input_file, region_sizes):
     sectors_written = 0
 
     with open(input_file, 'rb') as f:
-        sector_num = start_sector
-        while True:
-            data = f.read(512)
-            if not data:
-                break
-
-            # Pad last sector to 512 bytes if needed
-            if len(data) < 512:
-                data += b'\x00' * (512 - len(data))
-
-            success = usb.write_sector(region_id, sector_num, data)
-            if not success:
-                raise RuntimeError(f"Write failed at sector {sector_num}")
-
-            sectors_written += 1
-            sector_num += 1
-
+        for sectors_written in usb.write_stream(region_id, start_sector, file_sectors, file_chunks(f)):
             # Progress display with speed and ETA
             elapsed = time.time() - start_time
-            if elapsed > 0 and (sectors_written % 10 == 0 or sectors_written == file_sectors):  # Update every 10 sectors
+            if elapsed > 0:
                 speed_sectors_per_sec = sectors_written / elapsed
                 speed_mbps = (speed_sectors_per_sec * bytes_per_sector) / (1024 * 1024)
                 remaining_sectors = file_sectors - sectors_written
@@ -313,11 +713,222 @@ def write_flash(usb, region, start_sector, input_file, region_sizes):
                       f"({speed_mbps:.2f} MB/s, ETA: {eta_seconds:.0f}s)    ", end='\r', flush=True)
 
     print()  # Newline after progress
+    if not usb.flush_cache():
+        raise RuntimeError("Cache flush after write failed")
     elapsed_total = time.time() - start_time
     avg_speed = (sectors_written * bytes_per_sector) / (1024 * 1024) / elapsed_total
     print(f"Write complete: {sectors_written} sectors in {elapsed_total:.1f}s (avg {avg_speed:.2f} MB/s)")
 
 
+def erase_flash(usb, region, start_sector, num_sectors, erase_type, info, assume_yes=False):
+    """Erase/trim/discard a sector range of an eMMC region"""
+    region_id = REGIONS[region]
+    max_sectors = info['regions'][region]
+
+    # Handle length=0 meaning entire region
+    if num_sectors == 0:
+        num_sectors = max_sectors - start_sector
+
+    # Bounds checking
+    if start_sector >= max_sectors:
+        raise ValueError(f"Start sector {start_sector} exceeds region size {max_sectors} sectors")
+    if start_sector + num_sectors > max_sectors:
+        raise ValueError(f"Erase range {start_sector}+{num_sectors} exceeds region size {max_sectors} sectors")
+
+    group = info['erase_group_sectors'] or 1
+    if erase_type == 'secure' and (start_sector % group or num_sectors % group):
+        raise ValueError(f"Secure erase range must be aligned to the erase group ({group} sectors)")
+    if erase_type == 'trim' and not info['trim_supported']:
+        raise ValueError("Card does not support TRIM")
+    if erase_type == 'discard' and not info['discard_supported']:
+        raise ValueError("Card does not support DISCARD (needs eMMC 4.5, EXT_CSD_REV 6)")
+    if erase_type == 'secure' and not info['secure_erase_supported']:
+        raise ValueError("Card does not support secure erase")
+    if erase_type == 'erase' and (start_sector % group or (start_sector + num_sectors) % group):
+        print(f"Note: range is not aligned to the erase group ({group} sectors), "
+              f"the device trims the partial groups")
+
+    print(f"\n{erase_type.capitalize()} {num_sectors} sectors of {region} starting at sector {start_sector}")
+    if erase_type in ('erase', 'secure'):
+        print(f"Erased sectors will read as 0x{info['erased_byte']:02x}")
+    if not assume_yes:
+        response = input("Continue? [y/N]: ")
+        if response.lower() not in ['y', 'yes']:
+            print("Erase cancelled")
+            return
+
+    # Steps end on erase group boundaries so only the range ends can be partial
+    step = max(ERASE_STEP_SECTORS // group, 1) * group
+    start_time = time.time()
+    sector_num = start_sector
+    end_sector = start_sector + num_sectors
+    while sector_num < end_sector:
+        count = min(end_sector, (sector_num // group) * group + step) - sector_num
+        if not usb.erase(region_id, sector_num, count, ERASE_TYPES[erase_type]):
+            raise RuntimeError(f"Erase failed in sectors {sector_num}-{sector_num + count - 1}")
+        sector_num += count
+
+        done = sector_num - start_sector
+        elapsed = time.time() - start_time
+        print(f"Erase: {done}/{num_sectors} sectors ({elapsed:.1f}s)    ", end='\r', flush=True)
+
+    print()  # Newline after progress
+    elapsed_total = time.time() - start_time
+    print(f"Erase complete: {num_sectors} sectors in {elapsed_total:.1f}s")
+
+
+def erase_partition(usb, label, erase_type, info, assume_yes=False):
+    """Erase an entire userdata partition by label"""
+    gpt_info = read_gpt(usb, output_file=None)
+    if gpt_info is None:
+        raise RuntimeError("Failed to read GPT partition table")
+
+    partition = find_partition_by_label(gpt_info, label)
+    if partition is None:
+        available = [p['name'] for p in gpt_info['partitions']]
+        raise ValueError(f"Partition '{label}' not found. Available partitions: {', '.join(available)}")
+
+    print(f"\nFound partition: {partition['name']}")
+    print(f"  Range: LBA {partition['first_lba']} - {partition['last_lba']}")
+    erase_flash(usb, 'userdata', partition['first_lba'], partition['size_sectors'],
+                erase_type, info, assume_yes)
+
+
+def write_scattered(usb, region, targets, region_sizes):
+    """Write several small files at unrelated LBAs, batched into packed writes
+
+    targets: list of (sector, filename)
+    """
+    region_id = REGIONS[region]
+    max_sectors = region_sizes[region]
+
+    # Split into entries that fit the device's staging buffer
+    pieces = []
+    for sector, filename in targets:
+        with open(filename, 'rb') as f:
+            data = f.read()
+        if not data:
+            continue
+        if len(data) % 512:
+            data += b'\x00' * (512 - len(data) % 512)
+        if sector + len(data) // 512 > max_sectors:
+            raise ValueError(f"{filename} at {sector} exceeds region size {max_sectors} sectors")
+        print(f"  {filename}: {len(data) // 512} sectors at {sector}")
+        step = BATCH_BUF_SECTORS * 512
+        for i in range(0, len(data), step):
+            pieces.append((sector + i // 512, data[i:i + step]))
+
+    batches = []
+    batch, batch_sectors = [], 0
+    for sector, data in pieces:
+        count = len(data) // 512
+        if batch and (len(batch) == PACKED_MAX_ENTRIES or batch_sectors + count > BATCH_BUF_SECTORS):
+            batches.append(batch)
+            batch, batch_sectors = [], 0
+        batch.append((sector, data))
+        batch_sectors += count
+    if batch:
+        batches.append(batch)
+
+    total = sum(len(d) // 512 for _, d in pieces)
+    print(f"\nWriting {len(pieces)} pieces ({total} sectors) to {region} in {len(batches)} packed batches")
+    start_time = time.time()
+    for batch in batches:
+        ok, fail_index = usb.write_packed(region_id, batch)
+        if not ok:
+            if 1 <= fail_index <= len(batch):
+                sector, data = batch[fail_index - 1]
+                raise RuntimeError(f"Packed write failed at entry {fail_index} "
+                                   f"(sectors {sector}-{sector + len(data) // 512 - 1})")
+            raise RuntimeError(f"Packed write failed in batch starting at sector {batch[0][0]}")
+
+    if not usb.flush_cache():
+        raise RuntimeError("Cache flush after write failed")
+    elapsed_total = time.time() - start_time
+    print(f"Write complete: {total} sectors in {elapsed_total:.1f}s")
+
+
+def read_scattered(usb, region, targets, region_sizes):
+    """Read several ranges at unrelated LBAs through the eMMC command queue
+
+    targets: list of (sector, count, filename)
+    """
+    region_id = REGIONS[region]
+    max_sectors = region_sizes[region]
+
+    # One task per staging buffer's worth, remembering where each lands
+    pieces = []
+    for sector, count, filename in targets:
+        if count == 0 or sector + count > max_sectors:
+            raise ValueError(f"{filename}: {count} sectors at {sector} exceeds region size {max_sectors} sectors")
+        print(f"  {filename}: {count} sectors at {sector}")
+        for i in range(0, count, BATCH_BUF_SECTORS):
+            pieces.append((sector + i, min(BATCH_BUF_SECTORS, count - i), filename, i))
+
+    total = sum(p[1] for p in pieces)
+    print(f"\nReading {len(pieces)} pieces ({total} sectors) from {region}")
+    outputs = {filename: bytearray(count * 512) for _, count, filename in targets}
+    start_time = time.time()
+    for b in range(0, len(pieces), CMDQ_MAX_TASKS):
+        batch = pieces[b:b + CMDQ_MAX_TASKS]
+        ok, fail_index, results = usb.run_queue(region_id, [(p[0], p[1]) for p in batch], False)
+        if not ok:
+            if 1 <= fail_index <= len(batch):
+                sector, count = batch[fail_index - 1][:2]
+                raise RuntimeError(f"Queued read failed at task {fail_index} "
+                                   f"(sectors {sector}-{sector + count - 1})")
+            raise RuntimeError(f"Queued read failed in batch starting at sector {batch[0][0]}")
+        for index, data in results.items():
+            _, count, filename, offset = batch[index]
+            outputs[filename][offset * 512:(offset + count) * 512] = data
+
+    for filename, data in outputs.items():
+        with open(filename, 'wb') as f:
+            f.write(data)
+    elapsed_total = time.time() - start_time
+    print(f"Read complete: {total} sectors in {elapsed_total:.1f}s")
+
+
+def bench_usb(usb, region, num_sectors, sizes, region_sizes):
+    """Time range reads at each USB transfer unit, keep the fastest"""
+    region_id = REGIONS[region]
+    if num_sectors > region_sizes[region]:
+        raise ValueError(f"Length {num_sectors} exceeds region size {region_sizes[region]} sectors")
+
+    print(f"\nReading {num_sectors} sectors of {region} per transfer unit")
+    results = {}
+    for size in sizes:
+        agreed = usb.set_xfer_size(size)
+        if agreed in results:
+            continue
+        start_time = time.time()
+        usb.read_sectors(region_id, 0, num_sectors)
+        elapsed = time.time() - start_time
+        results[agreed] = (num_sectors * 512) / (1024 * 1024) / elapsed
+        print(f"  {agreed:6d} bytes: {results[agreed]:.2f} MB/s")
+
+    best = max(results, key=results.get)
+    usb.set_xfer_size(best)
+    print(f"Best: {best} bytes ({results[best]:.2f} MB/s), use --usb-chunk {best}")
+    return best
+
+
+def parse_at(value):
+    """--at LBA:FILE"""
+    sector, sep, filename = value.partition(':')
+    if not sep or not filename:
+        raise argparse.ArgumentTypeError(f"expected LBA:FILE, got '{value}'")
+    return int(sector, 0), filename
+
+
+def parse_read_at(value):
+    """--at LBA:COUNT:FILE"""
+    parts = value.split(':', 2)
+    if len(parts) != 3 or not parts[2]:
+        raise argparse.ArgumentTypeError(f"expected LBA:COUNT:FILE, got '{value}'")
+    return int(parts[0], 0), int(parts[1], 0), parts[2]
+
+
 def read_gpt(usb, output_file=None):
     """Read and parse GPT partition table from userdata region
 
@@ -330,13 +941,10 @@ def read_gpt(usb, output_file=None):
 
     region_id = REGIONS['userdata']
 
-    # Read protective MBR (LBA 0)
-    print("Reading protective MBR (LBA 0)...")
-    protective_mbr = usb.read_sector(region_id, 0)
-
-    # Read GPT header (LBA 1)
-    print("Reading GPT header (LBA 1)...")
-    gpt_header_sector = usb.read_sector(region_id, 1)
+    # Read protective MBR (LBA 0) and GPT header (LBA 1)
+    print("Reading protective MBR and GPT header (LBA 0-1)...")
+    head = usb.read_sectors(region_id, 0, 2)
+    protective_mbr, gpt_header_sector = head[:512], head[512:]
 
     # Parse header to get partition entry information
     try:
@@ -353,10 +961,7 @@ def read_gpt(usb, output_file=None):
     print(f"Reading {sectors_needed} sectors of partition entries (starting at LBA {header['partition_entries_lba']})...")
 
     # Read partition entry sectors
-    partition_entries_data = bytearray()
-    for i in range(sectors_needed):
-        sector = usb.read_sector(region_id, header['partition_entries_lba'] + i)
-        partition_entries_data.extend(sector)
+    partition_entries_data = usb.read_sectors(region_id, header['partition_entries_lba'], sectors_needed)
 
     # Parse complete GPT
     gpt_info = gpt_parser.parse_gpt(
@@ -442,15 +1047,14 @@ def read_partition(usb, label, output_file):
     bytes_per_sector = 512
 
     with open(output_file, 'wb') as f:
-        for i in range(num_sectors):
-            sector_num = start_lba + i
-            data = usb.read_sector(region_id, sector_num)
+        sectors_done = 0
+        for data in usb.read_stream(region_id, start_lba, num_sectors):
             f.write(data)
+            sectors_done += len(data) // 512
 
             # Progress display with speed and ETA
             elapsed = time.time() - start_time
-            if elapsed > 0 and (i % 10 == 0 or i == num_sectors - 1):
-                sectors_done = i + 1
+            if elapsed > 0:
                 speed_sectors_per_sec = sectors_done / elapsed
                 speed_mbps = (speed_sectors_per_sec * bytes_per_sector) / (1024 * 1024)
                 remaining_sectors = num_sectors - sectors_done
@@ -531,26 +1135,10 @@ def write_partition(usb, label, input_file):
     sectors_written = 0
 
     with open(input_file, 'rb') as f:
-        sector_num = start_lba
-        while True:
-            data = f.read(512)
-            if not data:
-                break
-
-            # Pad last sector to 512 bytes if needed
-            if len(data) < 512:
-                data += b'\x00' * (512 - len(data))
-
-            success = usb.write_sector(region_id, sector_num, data)
-            if not success:
-                raise RuntimeError(f"Write failed at sector {sector_num}")
-
-            sectors_written += 1
-            sector_num += 1
-
+        for sectors_written in usb.write_stream(region_id, start_lba, file_sectors, file_chunks(f)):
             # Progress display with speed and ETA
             elapsed = time.time() - start_time
-            if elapsed > 0 and (sectors_written % 10 == 0 or sectors_written == file_sectors):
+            if elapsed > 0:
                 speed_sectors_per_sec = sectors_written / elapsed
                 speed_mbps = (speed_sectors_per_sec * bytes_per_sector) / (1024 * 1024)
                 remaining_sectors = file_sectors - sectors_written
@@ -560,6 +1148,8 @@ def write_partition(usb, label, input_file):
                       f"({speed_mbps:.2f} MB/s, ETA: {eta_seconds:.0f}s)    ", end='\r', flush=True)
 
     print()  # Newline after progress
+    if not usb.flush_cache():
+        raise RuntimeError("Cache flush after write failed")
     elapsed_total = time.time() - start_time
     avg_speed = (sectors_written * bytes_per_sector) / (1024 * 1024) / elapsed_total
     print(f"Write complete: {sectors_written} sectors in {elapsed_total:.1f}s (avg {avg_speed:.2f} MB/s)")
@@ -625,6 +1215,8 @@ def roundtrip_test(usb, region, start_sector, num_sectors, region_sizes):
             raise RuntimeError(f"Write failed at sector {sector_num}")
         print(f"  Wrote sector {sector_num} ({i+1}/{num_sectors})", end='\r')
     print()
+    if not usb.flush_cache():
+        raise RuntimeError("Cache flush after write failed")
 
     # Step 3: Read back and verify
     print(f"\n[3/4] Reading back and verifying...")
@@ -657,6 +1249,8 @@ def roundtrip_test(usb, region, start_sector, num_sectors, region_sizes):
             raise RuntimeError(f"Restore failed at sector {sector_num}")
         print(f"  Restored sector {sector_num} ({i+1}/{num_sectors})", end='\r')
     print()
+    if not usb.flush_cache():
+        raise RuntimeError("Cache flush after restore failed")
 
     # Report results
     print(f"\n=== Results ===")
@@ -678,6 +1272,23 @@ def main():
         description='MT8113 eMMC Reflash Tool - Read and write eMMC sectors',
         epilog='Example: python3 mt8113_reflash.py read --region boot0 --start 0 --length 1024 --output boot0.bin'
     )
+    parser.add_argument('--xfer-mode', choices=list(XFER_MODES.keys()), default=None,
+                        help='Device-side transfer mode for multi-block reads/writes; range reads only overlap '
+                             'eMMC and USB with a DMA mode (default: leave as is, PIO on a fresh device)')
+    parser.add_argument('--auto-cmd', choices=list(AUTO_CMDS.keys()), default=None,
+                        help='Controller-issued CMD12/CMD23 for multi-block transfers; refused unless '
+                             'stage2 is built with EMMC_AUTO_CMD_ALLOW (default: leave as is)')
+    parser.add_argument('--cache', action='store_true',
+                        help='Enable the eMMC write cache; writes are flushed when they finish')
+    parser.add_argument('--max-timing', choices=list(TIMINGS.keys()), default=None,
+                        help='Cap the eMMC bus timing and re-init (default: fastest the card supports)')
+    parser.add_argument('--tuning', default=None, metavar='FILE',
+                        help='HS200/HS400 tuning file: loaded before re-init if present, saved after')
+    parser.add_argument('--native-usb', action='store_true',
+                        help="Switch the device to stage2's own USB driver (falls back to the BROM routines)")
+    parser.add_argument('--usb-chunk', type=int, default=0, metavar='BYTES',
+                        help=f'USB transfer unit to agree with the device, up to {USB_CHUNK_MAX}, e.g. from '
+                             f'bench-usb (default: 0, keeps the device default of {USB_CHUNK_DEVICE_DEFAULT})')
     subparsers = parser.add_subparsers(dest='command', required=True, help='Command to execute')
 
     # Dump EXT_CSD command
@@ -732,6 +1343,60 @@ def main():
     write_parser.add_argument('--input', required=True,
                              help='Input filename')
 
+    # Scattered write command
+    scattered_parser = subparsers.add_parser('write-scattered',
+                                            help='Write several files at unrelated LBAs in packed batches')
+    scattered_parser.add_argument('--region', default='userdata',
+                                 choices=['boot0', 'boot1', 'userdata'],
+                                 help='eMMC region to write to (default: userdata)')
+    scattered_parser.add_argument('--at', type=parse_at, action='append', required=True,
+                                 metavar='LBA:FILE', help='Write FILE at sector LBA (repeatable)')
+
+    # Scattered read command
+    scattered_read_parser = subparsers.add_parser('read-scattered',
+                                                 help='Read several LBA ranges as one command queue batch')
+    scattered_read_parser.add_argument('--region', default='userdata',
+                                      choices=['boot0', 'boot1', 'userdata'],
+                                      help='eMMC region to read from (default: userdata)')
+    scattered_read_parser.add_argument('--at', type=parse_read_at, action='append', required=True,
+                                      metavar='LBA:COUNT:FILE', help='Read COUNT sectors at LBA into FILE (repeatable)')
+
+    # Erase command
+    erase_parser = subparsers.add_parser('erase',
+                                        help='Erase/trim/discard sectors without writing them')
+    erase_parser.add_argument('--region', default=None,
+                             choices=['boot0', 'boot1', 'userdata'],
+                             help='eMMC region to erase')
+    erase_parser.add_argument('--start', type=int, default=0,
+                             help='Starting sector number (default: 0)')
+    erase_parser.add_argument('--length', type=int, default=0,
+                             help='Number of sectors to erase (0 = entire region from start)')
+    erase_parser.add_argument('--label', default=None,
+                             help='Erase a userdata partition by label instead of a sector range')
+    erase_parser.add_argument('--type', choices=list(ERASE_TYPES.keys()), default='erase',
+                             help='CMD38 variant (default: erase)')
+    erase_parser.add_argument('--yes', action='store_true',
+                             help='Do not ask for confirmation')
+
+    # Reboot command
+    subparsers.add_parser('reboot',
+                          help='Flush the write cache and reboot the device')
+
+    # Driver statistics command
+    subparsers.add_parser('stats',
+                          help='Show device-side driver counters')
+
+    # USB transfer unit benchmark
+    bench_parser = subparsers.add_parser('bench-usb',
+                                         help='Measure read throughput per USB transfer unit')
+    bench_parser.add_argument('--region', default='boot0',
+                              choices=['boot0', 'boot1', 'userdata'],
+                              help='eMMC region to read from (default: boot0)')
+    bench_parser.add_argument('--length', type=int, default=2048,
+                              help='Sectors to read per size (default: 2048)')
+    bench_parser.add_argument('--sizes', type=int, nargs='+', default=BENCH_CHUNK_SIZES,
+                              metavar='BYTES', help='Transfer units to try')
+
     # Roundtrip test command - tests end of boot1 (safe, boot1 is typically empty)
     # boot1 is 4MB = 8192 sectors, test 100 sectors starting at 8000
     subparsers.add_parser('roundtrip-test',
@@ -744,6 +1409,33 @@ def main():
         usb = MT8113USB()
         usb.connect()
 
+        if args.native_usb:
+            if usb.native_usb():
+                print("USB driver: native")
+            else:
+                print("USB driver: BROM (native takeover failed)")
+
+        if args.usb_chunk:
+            print(f"USB transfer unit: {usb.set_xfer_size(args.usb_chunk)} bytes")
+
+        if args.xfer_mode is not None:
+            if not usb.set_xfer_mode(XFER_MODES[args.xfer_mode]):
+                raise RuntimeError(f"Device rejected transfer mode '{args.xfer_mode}'")
+            print(f"Transfer mode: {args.xfer_mode}")
+
+        if args.auto_cmd is not None:
+            if not usb.set_auto_cmd(AUTO_CMDS[args.auto_cmd]):
+                raise RuntimeError(f"Device rejected auto command setting '{args.auto_cmd}'")
+            print(f"Auto command: {args.auto_cmd}")
+
+        if args.max_timing is not None or args.tuning is not None:
+            apply_timing_options(usb, args.max_timing, args.tuning)
+
+        if args.cache:
+            if not usb.set_cache(True):
+                raise RuntimeError("Device could not enable the write cache")
+            print("Write cache: on")
+
         if args.command == 'dump-extcsd':
             # Dump EXT_CSD command
             get_and_save_ext_csd(usb, args.output)
@@ -782,6 +1474,35 @@ def main():
             write_flash(usb, args.region, args.start, args.input,
                        region_sizes)
 
+        elif args.command == 'write-scattered':
+            info = get_and_save_ext_csd(usb, 'ext_csd.bin')
+            write_scattered(usb, args.region, args.at, info['regions'])
+
+        elif args.command == 'read-scattered':
+            info = get_and_save_ext_csd(usb, 'ext_csd.bin')
+            read_scattered(usb, args.region, args.at, info['regions'])
+
+        elif args.command == 'erase':
+            if (args.label is None) == (args.region is None):
+                raise ValueError("Specify either --region or --label")
+            info = get_and_save_ext_csd(usb, 'ext_csd.bin')
+            if args.label is not None:
+                erase_partition(usb, args.label, args.type, info, args.yes)
+            else:
+                erase_flash(usb, args.region, args.start, args.length, args.type, info, args.yes)
+
+        elif args.command == 'reboot':
+            usb.reboot()
+            print("Reboot requested")
+
+        elif args.command == 'bench-usb':
+            info = get_and_save_ext_csd(usb, 'ext_csd.bin')
+            bench_usb(usb, args.region, args.length, args.sizes, info['regions'])
+
+        elif args.command == 'stats':
+            for name, value in usb.get_stats().items():
+                print(f"{name:20s} {value}")
+
         elif args.command == 'roundtrip-test':
             # Get region sizes first
             info = get_and_save_ext_csd(usb, 'ext_csd.bin')
@@ -0,0 +1,229 @@
+#include "irq.h"
+#include "sleepy.h"
+
+// Minimal GICv3 setup so MSDC completion can wake the CPU from WFI.
+// BROM leaves IRQs masked and the vector base in ROM; we install our own
+// table (start.S) and fall back to polling if delivery can't be proven.
+
+static volatile uint32_t *gicd = (volatile uint32_t *)GICD_BASE;
+static volatile uint32_t *gicr = (volatile uint32_t *)GICR_BASE;
+
+// GICD word offsets
+#define GICD_CTLR       (0x0000 / 4)
+#define GICD_IGROUPR    (0x0080 / 4)
+#define GICD_ISENABLER  (0x0100 / 4)
+#define GICD_ICENABLER  (0x0180 / 4)
+#define GICD_IPRIORITYR (0x0400 / 4)
+#define GICD_IGRPMODR   (0x0D00 / 4)
+#define GICD_IROUTER    (0x6000 / 4)
+
+// GICD_CTLR bits
+#define GICD_CTLR_EN_GRP1NS (1 << 1)
+#define GICD_CTLR_EN_GRP1S  (1 << 2)
+#define GICD_CTLR_ARE_S     (1 << 4)
+#define GICD_CTLR_ARE_NS    (1 << 5)
+#define GICD_CTLR_RWP       (1u << 31)
+
+// GICR word offsets (SGI/PPI frame is 64 KiB above RD_base)
+#define GICR_WAKER      (0x0014 / 4)
+#define GICR_SGI        (0x10000 / 4)
+#define GICR_IGROUPR0   (GICR_SGI + 0x0080 / 4)
+#define GICR_ISENABLER0 (GICR_SGI + 0x0100 / 4)
+#define GICR_ICENABLER0 (GICR_SGI + 0x0180 / 4)
+#define GICR_IPRIORITYR (GICR_SGI + 0x0400 / 4)
+#define GICR_IGRPMODR0  (GICR_SGI + 0x0D00 / 4)
+
+// GICR_WAKER bits
+#define GICR_WAKER_SLEEP    (1 << 1)
+#define GICR_WAKER_ASLEEP   (1 << 2)
+
+#define IRQ_PRIORITY 0xA0
+#define IRQ_PMR      0xF0
+#define IRQ_GIC_TIMEOUT_US 10000
+#define IRQ_PROBE_US 1000
+
+// SCTLR bits
+#define SCTLR_V         (1 << 13)
+#define SCTLR_TE        (1 << 30)
+
+// CNTP_CTL bits
+#define CNTP_CTL_ENABLE (1 << 0)
+#define CNTP_CTL_IMASK  (1 << 1)
+
+extern uint32_t vectors[];
+extern void irq_set_stack(uint32_t sp);
+
+static void (*handlers[IRQ_MAX])(void);
+static uint32_t irq_stack[256] __attribute__((aligned(8)));
+static volatile uint32_t timer_fired;
+static uint32_t irq_on;
+
+static inline void isb(void) {
+    asm volatile ("isb" ::: "memory");
+}
+
+static inline void dsb(void) {
+    asm volatile ("dsb" ::: "memory");
+}
+
+static void timer_arm(uint32_t ticks) {
+    asm volatile ("mcr p15, 0, %0, c14, c2, 0" :: "r"(ticks));
+    asm volatile ("mcr p15, 0, %0, c14, c2, 1" :: "r"(CNTP_CTL_ENABLE));
+    isb();
+}
+
+static void timer_stop(void) {
+    asm volatile ("mcr p15, 0, %0, c14, c2, 1" :: "r"(0));
+    isb();
+}
+
+static int gic_wait(volatile uint32_t *reg, uint32_t mask, uint32_t val) {
+    uint32_t start = timer_ticks();
+    uint32_t limit = timer_us_to_ticks(IRQ_GIC_TIMEOUT_US);
+    while ((*reg & mask) != val) {
+        if (timer_ticks() - start > limit) return -1;
+    }
+    return 0;
+}
+
+static void gic_enable(uint32_t id) {
+    if (id < 32) {
+        gicr[GICR_ISENABLER0] = 1u << id;
+    } else {
+        gicd[GICD_ISENABLER + id / 32] = 1u << (id % 32);
+    }
+}
+
+static void gic_disable(uint32_t id) {
+    if (id < 32) {
+        gicr[GICR_ICENABLER0] = 1u << id;
+    } else {
+        gicd[GICD_ICENABLER + id / 32] = 1u << (id % 32);
+    }
+}
+
+// Route an interrupt to Secure Group 1 (BROM hands over in secure SVC)
+static void gic_config(uint32_t id) {
+    volatile uint32_t *group = (id < 32) ? &gicr[GICR_IGROUPR0] : &gicd[GICD_IGROUPR + id / 32];
+    volatile uint32_t *mode = (id < 32) ? &gicr[GICR_IGRPMODR0] : &gicd[GICD_IGRPMODR + id / 32];
+    volatile uint8_t *prio = (id < 32) ? (volatile uint8_t *)&gicr[GICR_IPRIORITYR]
+                                       : (volatile uint8_t *)&gicd[GICD_IPRIORITYR];
+    uint32_t bit = 1u << (id % 32);
+
+    *group &= ~bit;
+    *mode |= bit;
+    prio[id] = IRQ_PRIORITY;
+    if (id >= 32) {
+        gicd[GICD_IROUTER + id * 2] = 0;
+        gicd[GICD_IROUTER + id * 2 + 1] = 0;
+    }
+}
+
+void irq_handler(void) {
+    uint32_t id;
+    asm volatile ("mrc p15, 0, %0, c12, c12, 0" : "=r"(id));   // ICC_IAR1
+    id &= 0xFFFFFF;
+    if (id >= IRQ_ID_SPURIOUS) return;
+
+    if (id < IRQ_MAX && handlers[id]) {
+        handlers[id]();
+    } else if (id == IRQ_ID_TIMER) {
+        timer_stop();
+        timer_fired = 1;
+    } else {
+        gic_disable(id);
+    }
+    asm volatile ("mcr p15, 0, %0, c12, c12, 1" :: "r"(id));   // ICC_EOIR1
+    isb();
+}
+
+int irq_ready(void) {
+    return irq_on;
+}
+
+int irq_register(uint32_t id, void (*fn)(void)) {
+    if (!irq_on || id >= IRQ_MAX || id == IRQ_ID_TIMER) return -1;
+    handlers[id] = fn;
+    gic_config(id);
+    gic_enable(id);
+    return 0;
+}
+
+// Sleep until any enabled interrupt or the timer, whichever is first.
+// Called with IRQs masked so a wakeup between the caller's check and WFI
+// is not lost: WFI still wakes on a pending IRQ and the handler runs once
+// we unmask.
+void irq_wait(uint32_t ticks) {
+    if (!irq_on) return;
+    timer_fired = 0;
+    timer_arm(ticks ? ticks : 1);
+    dsb();
+    asm volatile ("wfi");
+    asm volatile ("cpsie i\n\tisb\n\tcpsid i" ::: "memory");
+    timer_stop();
+}
+
+int irq_init(void) {
+    uint32_t sre, cpsr, sctlr, vbar;
+
+    if (!IRQ_ENABLE) return -1;
+    if (irq_on) return 0;
+    if (!timer_running()) return -1;
+
+    asm volatile ("mrs %0, cpsr" : "=r"(cpsr));
+    asm volatile ("mrc p15, 0, %0, c12, c0, 0" : "=r"(vbar));
+    asm volatile ("mrc p15, 0, %0, c1, c0, 0" : "=r"(sctlr));
+
+    // System register interface
+    asm volatile ("mrc p15, 0, %0, c12, c12, 5" : "=r"(sre));
+    asm volatile ("mcr p15, 0, %0, c12, c12, 5" :: "r"(sre | 1));
+    isb();
+    asm volatile ("mrc p15, 0, %0, c12, c12, 5" : "=r"(sre));
+    if (!(sre & 1)) return -1;
+
+    // Distributor
+    gicd[GICD_CTLR] |= GICD_CTLR_ARE_S | GICD_CTLR_ARE_NS;
+    if (gic_wait(&gicd[GICD_CTLR], GICD_CTLR_RWP, 0) != 0) return -1;
+    gicd[GICD_CTLR] |= GICD_CTLR_EN_GRP1S | GICD_CTLR_EN_GRP1NS;
+    if (gic_wait(&gicd[GICD_CTLR], GICD_CTLR_RWP, 0) != 0) return -1;
+
+    // Redistributor for this CPU
+    gicr[GICR_WAKER] &= ~GICR_WAKER_SLEEP;
+    if (gic_wait(&gicr[GICR_WAKER], GICR_WAKER_ASLEEP, 0) != 0) return -1;
+
+    // CPU interface
+    asm volatile ("mcr p15, 0, %0, c4, c6, 0" :: "r"(IRQ_PMR));     // ICC_PMR
+    asm volatile ("mcr p15, 0, %0, c12, c12, 7" :: "r"(1));         // ICC_IGRPEN1
+    isb();
+
+    irq_set_stack((uint32_t)&irq_stack[sizeof(irq_stack) / 4]);
+    asm volatile ("mcr p15, 0, %0, c12, c0, 0" :: "r"((uint32_t)vectors));
+    // SCTLR.V off to use VBAR, SCTLR.TE off as the vectors are ARM code
+    asm volatile ("mcr p15, 0, %0, c1, c0, 0" :: "r"(sctlr & ~(SCTLR_V | SCTLR_TE)));
+    isb();
+
+    gic_config(IRQ_ID_TIMER);
+    gic_enable(IRQ_ID_TIMER);
+
+    // Prove delivery with a short timer shot before trusting WFI
+    timer_fired = 0;
+    timer_arm(timer_us_to_ticks(IRQ_PROBE_US / 10));
+    asm volatile ("cpsie i" ::: "memory");
+    uint32_t start = timer_ticks();
+    uint32_t limit = timer_us_to_ticks(IRQ_PROBE_US);
+    while (!timer_fired && timer_ticks() - start < limit) {}
+    asm volatile ("cpsid i" ::: "memory");
+    timer_stop();
+
+    if (!timer_fired) {
+        gic_disable(IRQ_ID_TIMER);
+        asm volatile ("mcr p15, 0, %0, c12, c0, 0" :: "r"(vbar));
+        asm volatile ("mcr p15, 0, %0, c1, c0, 0" :: "r"(sctlr));
+        asm volatile ("msr cpsr_c, %0" :: "r"(cpsr) : "memory");
+        isb();
+        return -1;
+    }
+
+    irq_on = 1;
+    return 0;
+}
@@ -0,0 +1,35 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+
+// GICv3 on the MT8113/MT8512 family. Addresses follow the MT8512 layout
+// and have not been confirmed on MT8113, so allow overriding at build time.
+#ifndef GICD_BASE
+#define GICD_BASE 0x0C000000
+#endif
+#ifndef GICR_BASE
+#define GICR_BASE 0x0C080000
+#endif
+
+// The GIC bases and the IRQ ids in the drivers are unconfirmed guesses
+// for MT8113, so the interrupt path is off unless the build turns it on
+#ifndef IRQ_ENABLE
+#define IRQ_ENABLE 0
+#endif
+
+// Physical timer PPI, used to bound irq_wait(). Stage2 runs in the BROM's
+// secure SVC context, where CNTP_* is the secure timer on PPI 29.
+#ifndef IRQ_ID_TIMER
+#define IRQ_ID_TIMER 29
+#endif
+#define IRQ_ID_SPURIOUS 1020
+#define IRQ_MAX 256
+
+int irq_init(void);
+int irq_ready(void);
+int irq_register(uint32_t id, void (*fn)(void));
+void irq_wait(uint32_t ticks);
+void irq_handler(void);
+
+#endif
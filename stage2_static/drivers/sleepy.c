@@ -28,27 +28,63 @@ void mdelay (unsigned long msec)
     usleep(usec);
 }*/
 
-void sleepy(void) {
-    // TODO: do better
-    for (volatile int i = 0; i < 0x80000; ++i) {}
+// Generic timer physical count (low word) as the time base. If the
+// counter turns out not to run, every timer_ticks() call counts as one
+// tick so timeouts still expire, like the old iteration counters.
+static uint32_t ticks_per_us;
+static int counter_state = -1;     // -1 unknown, 0 stopped, 1 running
+static uint32_t soft_ticks;
+
+static uint32_t cntpct_low(void) {
+    uint32_t lo, hi;
+    asm volatile ("isb\n\tmrrc p15, 0, %0, %1, c14" : "=r"(lo), "=r"(hi));
+    (void)hi;
+    return lo;
+}
+
+static void timer_setup(void) {
+    uint32_t freq;
+    asm volatile ("mrc p15, 0, %0, c14, c0, 0" : "=r"(freq));
+    if (freq == 0) freq = TIMER_FREQ_DEFAULT;
+    ticks_per_us = freq / 1000000;
+    if (ticks_per_us == 0) ticks_per_us = 1;
+
+    uint32_t t0 = cntpct_low();
+    for (volatile int i = 0; i < 1000; ++i) {}
+    counter_state = (cntpct_low() != t0);
+}
+
+uint32_t timer_ticks(void) {
+    if (counter_state < 0) timer_setup();
+    if (!counter_state) return soft_ticks++;
+    return cntpct_low();
 }
 
-unsigned long usleep (unsigned long msec)
+uint32_t timer_us_to_ticks(uint32_t usec) {
+    if (counter_state < 0) timer_setup();
+    return usec * ticks_per_us;
+}
+
+int timer_running(void) {
+    if (counter_state < 0) timer_setup();
+    return counter_state;
+}
+
+unsigned long usleep (unsigned long usec)
 {
-    (void)msec;
-    sleepy();
+    udelay(usec);
     return 0;
 }
 
 void mdelay (unsigned long msec)
 {
-    (void)msec;
-    sleepy();
+    udelay(msec * 1000);
 }
 
 /* delay usec useconds */
 void udelay (unsigned long usec)
 {
-    (void)usec;
-    sleepy();
-}
\ No newline at end of file
+    uint32_t start = timer_ticks();
+    uint32_t ticks = timer_us_to_ticks(usec);
+    while (timer_ticks() - start < ticks) {}
+}
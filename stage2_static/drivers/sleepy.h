@@ -1,9 +1,18 @@
 #ifndef SLEEPY
 #define SLEEPY
 
+#include <stdint.h>
+
+// Used when CNTFRQ was never programmed (MTK system counter rate)
+#define TIMER_FREQ_DEFAULT 13000000
+
 #define ITERS_PER_USEC 0x80
 unsigned long usleep(unsigned long useconds);
 void mdelay (unsigned long msec);
 void udelay (unsigned long usec);
 
-#endif
\ No newline at end of file
+uint32_t timer_ticks(void);
+uint32_t timer_us_to_ticks(uint32_t usec);
+int timer_running(void);
+
+#endif
@@ -1,5 +1,8 @@
 #include "printf.h"
+#include "libc.h"
 #include "mt8113_emmc.h"
+#include "drivers/sleepy.h"
+#include "drivers/irq.h"
 
 #define MSDC_BASE         0x11230000
 #define MSDC_CFG          (0x00/4)
@@ -20,14 +23,23 @@
 #define SDC_RESP3         (0x4C/4)
 #define SDC_BLK_NUM       (0x50/4)
 #define SDC_ADV_CFG0      (0x64/4)
+#define SDC_ACMD_RESP     (0x80/4)
+#define MSDC_DMA_SA_HIGH  (0x8C/4)
+#define MSDC_DMA_SA       (0x90/4)
+#define MSDC_DMA_CA       (0x94/4)
+#define MSDC_DMA_CTRL     (0x98/4)
+#define MSDC_DMA_CFG      (0x9C/4)
+#define MSDC_DMA_LEN      (0xA8/4)
 #define PATCH_BIT0        (0xB0/4)
 #define PATCH_BIT1        (0xB4/4)
 #define PATCH_BIT2        (0xB8/4)
 #define PAD_TUNE0         (0xEC/4)
 #define DAT_RD_DLY0       (0xF0/4)
 #define DAT_RD_DLY1       (0xF4/4)
+#define PAD_DS_TUNE       (0x188/4)
 #define EMMC50_CFG0       (0x208/4)
 #define EMMC50_CFG1       (0x20C/4)
+#define EMMC50_CFG3       (0x220/4)
 #define EMMC50_BLOCK_LEN  (0x228/4)
 
 #define EMMC_PART_USER    0
@@ -47,22 +59,29 @@
 #define MSDC_CFG_CKMOD          (0x3  << 20)
 #define MSDC_CFG_CKMOD_HS400    (0x1  << 22)
 
-// MSDC_INT bits
-#define MSDC_INT_MMCIRQ         (0x1  << 0)
-#define MSDC_INT_CDSC           (0x1  << 1)
-#define MSDC_INT_ACMDRDY        (0x1  << 3)
-#define MSDC_INT_ACMDTMO        (0x1  << 4)
-#define MSDC_INT_ACMDCRCERR     (0x1  << 5)
-#define MSDC_INT_DMAQ_EMPTY     (0x1  << 6)
-#define MSDC_INT_SDIOIRQ        (0x1  << 7)
-#define MSDC_INT_CMDRDY         (0x1  << 8)
-#define MSDC_INT_CMDTMO         (0x1  << 9)
-#define MSDC_INT_RSPCRCERR      (0x1  << 10)
-#define MSDC_INT_CSTA           (0x1  << 11)
-#define MSDC_INT_XFER_COMPL     (0x1  << 12)
-#define MSDC_INT_DXFER_DONE     (0x1  << 13)
-#define MSDC_INT_DATTMO         (0x1  << 14)
-#define MSDC_INT_DATCRCERR      (0x1  << 15)
+// MSDC_IOCON bits
+#define MSDC_IOCON_DDR50CKD     (0x1  << 4)
+
+// MSDC_PATCH_BIT0 bits
+#define MSDC_PB0_RD_DAT_SEL     (0x1  << 3)
+
+// MSDC_PAD_TUNE0 bits
+#define MSDC_PAD_TUNE0_DATRRDLY (0x1F << 8)
+#define MSDC_PAD_TUNE0_CMDRDLY  (0x1F << 16)
+#define MSDC_PAD_TUNE0_DEFAULT  (0x202000)     // DATRRDLYSEL | CMDRRDLYSEL
+#define MSDC_PAD_DELAY_MAX      (32)
+
+// MSDC_PATCH_BIT2 bits
+#define MSDC_PB2_CFGCRCSTS      (0x1  << 28)
+
+// PAD_DS_TUNE bits
+#define PAD_DS_TUNE_DLY1        (0x1f << 2)
+
+// EMMC50_CFG0 / CFG1 / CFG3 bits
+#define EMMC50_CFG_PADCMD_LATCHCK   (0x1 << 0)
+#define EMMC50_CFG_CMD_RESP_SEL     (0x1 << 9)
+#define EMMC50_CFG1_DSCFG           (0x1 << 28)
+#define EMMC50_CFG3_OUTS_WR         (0x1f << 0)
 
 // MSDC_FIFOCS bits
 #define MSDC_FIFOCS_RXCNT       (0xff << 0)
@@ -81,6 +100,21 @@
 #define SDC_CMD_RW              (0x1  << 13)
 #define SDC_CMD_STOP            (0x1  << 14)
 #define SDC_CMD_BLKLEN          (0xfff<< 16)
+#define SDC_CMD_AUTOCMD         (0x3  << 28)
+
+// MSDC_DMA_CTRL bits
+#define MSDC_DMA_CTRL_START     (0x1  << 0)
+#define MSDC_DMA_CTRL_STOP      (0x1  << 1)
+#define MSDC_DMA_CTRL_MODE      (0x1  << 8)
+#define MSDC_DMA_CTRL_LASTBUF   (0x1  << 10)
+#define MSDC_DMA_CTRL_BRUSTSZ   (0x7  << 12)
+
+// MSDC_DMA_CFG bits
+#define MSDC_DMA_CFG_STS        (0x1  << 0)
+#define MSDC_DMA_CFG_DECSEN     (0x1  << 1)
+
+// MSDC_PS bits
+#define MSDC_PS_DAT0            (0x1  << 16)
 
 // SDC_STS bits
 #define SDC_STS_SDCBUSY         (0x1  << 0)
@@ -92,8 +126,176 @@
 #define MSDC_BUS_1BITS          (0)
 #define MSDC_BUS_4BITS          (1)
 #define MSDC_BUS_8BITS          (2)
+#define MSDC_BRUST_64B          (6)
+#define MSDC_MAX_BD             (8)
+
+// DMA descriptors, layout from mt_sd.h
+typedef struct {
+    uint32_t hwo:1;
+    uint32_t bdp:1;
+    uint32_t rsv0:6;
+    uint32_t chksum:8;
+    uint32_t intr:1;
+    uint32_t rsv1:7;
+    uint32_t nexth4:4;
+    uint32_t ptrh4:4;
+    uint32_t next;
+    uint32_t ptr;
+    uint32_t buflen:24;
+    uint32_t extlen:8;
+    uint32_t arg;
+    uint32_t blknum;
+    uint32_t cmd;
+} gpd_t;
+
+typedef struct {
+    uint32_t eol:1;
+    uint32_t rsv0:7;
+    uint32_t chksum:8;
+    uint32_t rsv1:1;
+    uint32_t blkpad:1;
+    uint32_t dwpad:1;
+    uint32_t rsv2:5;
+    uint32_t nexth4:4;
+    uint32_t ptrh4:4;
+    uint32_t next;
+    uint32_t ptr;
+    uint32_t buflen:24;
+    uint32_t rsv3:8;
+} bd_t;
+
+// MSDC source clock. The identification divider (0x185 -> ~260kHz) and
+// the old fixed divider (0x4 -> ~25MHz) both put it at ~400MHz, which
+// matches hclks_msdc50[1] in stage2_static_orig/drivers/mmc.c.
+#ifndef MSDC_SRC_CLK
+#define MSDC_SRC_CLK            (400000000)
+#endif
+
+#define EMMC_CLK_LEGACY         (26000000)
+#define EMMC_CLK_HS             (52000000)
+#define EMMC_CLK_HS200          (200000000)
+
+// Completion waits, in microseconds of generic timer time
+#define MSDC_BUSY_TIMEOUT_MS    (2000)
+#define MSDC_WRITE_TIMEOUT_US   (1000000)
+#define MSDC_DMA_TIMEOUT_US     (2000000)
+#define MSDC_DMA_STOP_TIMEOUT_US (10000)
+#define MSDC_PIO_TIMEOUT_US     (100000)
+
+// Sleep on the MSDC interrupt instead of spinning, with IRQ_ENABLE. The
+// GIC id is the MT8516 msdc0 SPI and has not been confirmed on MT8113; a
+// wrong id is caught by a probe at init and the driver goes back to polling.
+#ifndef MSDC_USE_IRQ
+#define MSDC_USE_IRQ            IRQ_ENABLE
+#endif
+#ifndef MSDC_IRQ_ID
+#define MSDC_IRQ_ID             (32 + 78)
+#endif
+#define MSDC_IRQ_PROBE_US       (1000)
+
+// Auto commands the controller adds to multi-block transfers. Refused
+// unless built with EMMC_AUTO_CMD_ALLOW: where this MSDC reports the auto
+// command's ready, timeout and CRC events is unverified, and in mt_sd.h
+// they sit on the bits read here as XFER_COMPL/DATTMO/DATCRCERR.
+#ifndef EMMC_AUTO_CMD_ALLOW
+#define EMMC_AUTO_CMD_ALLOW     0
+#endif
+#ifndef EMMC_AUTO_CMD
+#define EMMC_AUTO_CMD           EMMC_AUTO_CMD_NONE
+#endif
+#if EMMC_AUTO_CMD != EMMC_AUTO_CMD_NONE && !EMMC_AUTO_CMD_ALLOW
+#error "EMMC_AUTO_CMD needs EMMC_AUTO_CMD_ALLOW"
+#endif
+
+// Return from a multi-block write as soon as its data is on the card and
+// let the programming busy run out while the caller fetches more data.
+// The wait happens before the next command instead.
+#ifndef EMMC_DEFER_BUSY
+#define EMMC_DEFER_BUSY         1
+#endif
+
+// Highest timing emmc_init may select
+#ifndef EMMC_MAX_TIMING
+#define EMMC_MAX_TIMING         EMMC_TIMING_HS400ES
+#endif
+
+// Card bring-ups per emmc_init, each retry after a failed HS400/HS400ES
+// switch one timing lower
+#define EMMC_INIT_ATTEMPTS      3
+
+// EXT_CSD DEVICE_TYPE (196) bits
+#define EXT_CSD_CARD_TYPE_HS_52     (1 << 1)
+#define EXT_CSD_CARD_TYPE_DDR_52    (0x3 << 2)
+#define EXT_CSD_CARD_TYPE_HS200     (0x3 << 4)
+#define EXT_CSD_CARD_TYPE_HS400     (0x3 << 6)
+#define EXT_CSD_STROBE_SUPPORT      (1 << 0)    // STROBE_SUPPORT (184)
+
+// EXT_CSD cache fields
+#define EXT_CSD_FLUSH_CACHE         32
+#define EXT_CSD_CACHE_CTRL          33
+#define EXT_CSD_CACHE_SIZE          249         // 4 bytes, KiB
+
+// No JEDEC bound on a flush, allow for a full cache on a slow card
+#ifndef EMMC_FLUSH_TIMEOUT_MS
+#define EMMC_FLUSH_TIMEOUT_MS       30000
+#endif
+
+// EXT_CSD packed command fields
+#define EXT_CSD_PACKED_FAILURE_INDEX 35
+#define EXT_CSD_PACKED_CMD_STATUS   36
+#define EXT_CSD_EXP_EVENTS_CTRL     56
+#define EXT_CSD_REV                 192
+#define EXT_CSD_MAX_PACKED_WRITES   500
+#define EXT_CSD_PACKED_EVENT_EN     (1 << 3)    // EXP_EVENTS_CTRL bits
+#define EXT_CSD_PACKED_STS_ERROR    (1 << 0)    // PACKED_COMMAND_STATUS bits
+#define EXT_CSD_PACKED_STS_INDEXED  (1 << 1)
+
+// Packed command header (first block of the transfer), JEDEC 4.5
+#define PACKED_CMD_VER              0x01
+#define PACKED_CMD_WR               0x02
+#define CMD23_PACKED                (1 << 30)
+
+// EXT_CSD command queue fields
+#define EXT_CSD_CMDQ_MODE_EN        15
+#define EXT_CSD_CMDQ_DEPTH          307         // bits 4:0, depth - 1
+#define EXT_CSD_CMDQ_SUPPORT        308
+
+// CMD44 QUEUED_TASK_PARAMS / CMD13 bits for the command queue
+#define CMDQ_TASK_READ              (1 << 30)
+#define CMDQ_TASK_ID(x)             ((x) << 16)
+#define CMD13_SQS                   (1 << 15)
+#define CMD48_DISCARD_QUEUE         1
+
+#define MSDC_CMDQ_TIMEOUT_US        (1000000)
+#define MSDC_CMDQ_POLL_US           (20)
 
-// These are DIFFERENT from mt_sd.h definitions above.
+// EXT_CSD erase fields
+#define EXT_CSD_ERASE_GROUP_DEF     175
+#define EXT_CSD_SEC_TRIM_MULT       229
+#define EXT_CSD_SEC_ERASE_MULT      230
+#define EXT_CSD_SEC_FEATURE_SUPPORT 231
+#define EXT_CSD_TRIM_MULT           232
+#define EXT_CSD_ERASE_TIMEOUT_MULT  223
+#define EXT_CSD_HC_ERASE_GRP_SIZE   224
+#define EXT_CSD_SEC_ER_EN           (1 << 0)    // SEC_FEATURE_SUPPORT bits
+#define EXT_CSD_SEC_GB_CL_EN        (1 << 4)
+
+// Erase/trim runs per CMD38, bounds each busy wait (and its timeout math)
+#ifndef EMMC_ERASE_CHUNK_GROUPS
+#define EMMC_ERASE_CHUNK_GROUPS     64
+#endif
+#define EMMC_ERASE_UNIT_MS          300         // *_MULT unit, JEDEC 4.5
+
+// Confirm a new bus width with CMD19/CMD14 before using it
+#ifndef EMMC_BUS_TEST
+#define EMMC_BUS_TEST           (1)
+#endif
+
+// MSDC_INT bits, the one layout this driver uses. mt_sd.h puts
+// XFER_COMPL/DATTMO/DATCRCERR at bits 12/14/15 and its auto command
+// events at 3/4/5, but on MT8113 the data events were observed at 3/4/5
+// by the original driver, and init enables exactly these (INTEN 0x738).
+// Where the auto command and descriptor checksum events land is unknown.
 #define INT_CMDRDY        (1 << 8)
 #define INT_DATCRCERR     (1 << 5)
 #define INT_DATTMO        (1 << 4)
@@ -105,13 +307,131 @@
 #define CMD_R2_RESP       (2 << 7)
 #define CMD_R3_RESP       (3 << 7)
 #define CMD_SINGLE_BLK    (1 << 11)
+#define CMD_MULTI_BLK     (2 << 11)
 #define CMD_WRITE         (1 << 13)
+#define CMD_STOP          (1 << 14)
 #define CMD_BLKLEN(x)     ((x) << 16)
+#define CMD_AUTO_CMD12    (1 << 28)
+#define CMD_AUTO_CMD23    (2 << 28)
+
+// R1 card status bits that mean the command failed
+#define R1_ERRORS         (0xFDF90008)
+#define R1_WP_ERASE_SKIP  (1 << 15)
+#define R1_EXCEPTION_EVENT (1 << 6)
 
 static volatile uint32_t *msdc = (volatile uint32_t*)MSDC_BASE;
 static uint32_t current_partition = 0xFF;
+static uint32_t xfer_mode = EMMC_XFER_PIO;
+static uint32_t bus_width = 1;
+static uint32_t bus_clock = 0;
+static uint32_t timing = EMMC_TIMING_LEGACY;
+static uint32_t auto_cmd = EMMC_AUTO_CMD;
+static uint32_t max_timing = EMMC_MAX_TIMING;
+static struct emmc_tuning tuning;
+// What the driver last did to the card and controller. The first read
+// after a controller reset, a partition switch or a write returns stale
+// data, and so can a read that follows a transfer leaving words in the
+// RX FIFO. A discard read is only spent when one of those happened.
+static struct {
+    uint8_t part_pending;   // reset or partition switch, no read since
+    uint8_t write_done;     // write issued, no read since
+    uint8_t fifo_residue;   // RX FIFO not empty after the last read
+} msdc_state;
+
+// Card state as far as the last command outcome tells. TRAN and BUSY
+// (R1b or write programming, ends when DAT0 is released) are settled
+// without a CMD13. Only UNKNOWN costs a status round-trip.
+#define CARD_STATE_UNKNOWN      0
+#define CARD_STATE_TRAN         1
+#define CARD_STATE_BUSY         2
+
+static uint32_t card_state = CARD_STATE_UNKNOWN;
+
+static volatile uint32_t msdc_irq_fired;
+static uint32_t msdc_irq_on;
 
+static uint32_t discard_reads;
+static uint32_t cmd13_sent;
+static uint32_t cmd13_skipped;
+static uint32_t auto_cmd_sent;
+static uint32_t auto_cmd_errors;
+static uint32_t cache_on;
+static uint32_t cache_flushes;
+static uint32_t packed_batches;
+static uint32_t packed_events_on;
+static uint32_t packed_hdr[128];
+static uint32_t cmdq_on;
+static uint32_t cmdq_tasks;
+static uint32_t pipe_emmc_bound;
+static uint32_t pipe_host_bound;
+static uint32_t pipe_wait_ticks;
+static uint32_t busy_deferred;
+static uint32_t write_busy_pending;
+static uint32_t write_busy_failed;
+
+// Read in flight between emmc_read_async and emmc_read_wait
+static struct {
+    uint32_t active;
+    uint32_t dma;       // data phase still owned by the DMA engine
+    uint32_t acmd;
+    int ret;            // result of a read that already completed
+} read_async;
+static uint32_t discard_blk[128];
+// EXT_CSD snapshot, valid from the first read after init until our own
+// next CMD6. The read-only properties segment (192+) stays usable as a
+// reference for data path checks even while the flag is clear.
+static uint32_t ext_csd_buf[128];
+static uint32_t ext_csd_valid;
+static uint32_t ext_csd_hits;
+static uint32_t ext_csd_fetches;
+static uint32_t ext_csd_chk[128];
+static uint32_t tuning_blk[32];
+
+// CMD21 tuning block patterns (JEDEC 4.5, 4-bit and 8-bit bus)
+static const uint8_t tuning_blk_4bit[64] = {
+    0xff, 0x0f, 0xff, 0x00, 0xff, 0xcc, 0xc3, 0xcc,
+    0xc3, 0x3c, 0xcc, 0xff, 0xfe, 0xff, 0xfe, 0xef,
+    0xff, 0xdf, 0xff, 0xdd, 0xff, 0xfb, 0xff, 0xfb,
+    0xbf, 0xff, 0x7f, 0xff, 0x77, 0xf7, 0xbd, 0xef,
+    0xff, 0xf0, 0xff, 0xf0, 0x0f, 0xfc, 0xcc, 0x3c,
+    0xcc, 0x33, 0xcc, 0xcf, 0xff, 0xef, 0xff, 0xee,
+    0xff, 0xfd, 0xff, 0xfd, 0xdf, 0xff, 0xbf, 0xff,
+    0xbb, 0xff, 0xf7, 0xff, 0xf7, 0x7f, 0x7b, 0xde,
+};
+
+static const uint8_t tuning_blk_8bit[128] = {
+    0xff, 0xff, 0x00, 0xff, 0xff, 0xff, 0x00, 0x00,
+    0xff, 0xff, 0xcc, 0xcc, 0xcc, 0x33, 0xcc, 0xcc,
+    0xcc, 0x33, 0x33, 0xcc, 0xcc, 0xcc, 0xff, 0xff,
+    0xff, 0xee, 0xff, 0xff, 0xff, 0xee, 0xee, 0xff,
+    0xff, 0xff, 0xdd, 0xff, 0xff, 0xff, 0xdd, 0xdd,
+    0xff, 0xff, 0xff, 0xbb, 0xff, 0xff, 0xff, 0xbb,
+    0xbb, 0xff, 0xff, 0xff, 0x77, 0xff, 0xff, 0xff,
+    0x77, 0x77, 0xff, 0x77, 0xbb, 0xdd, 0xee, 0xff,
+    0xff, 0xff, 0xff, 0x00, 0xff, 0xff, 0xff, 0x00,
+    0x00, 0xff, 0xff, 0xcc, 0xcc, 0xcc, 0x33, 0xcc,
+    0xcc, 0xcc, 0x33, 0x33, 0xcc, 0xcc, 0xcc, 0xff,
+    0xff, 0xff, 0xee, 0xff, 0xff, 0xff, 0xee, 0xee,
+    0xff, 0xff, 0xff, 0xdd, 0xff, 0xff, 0xff, 0xdd,
+    0xdd, 0xff, 0xff, 0xff, 0xbb, 0xff, 0xff, 0xff,
+    0xbb, 0xbb, 0xff, 0xff, 0xff, 0x77, 0xff, 0xff,
+    0xff, 0x77, 0x77, 0xff, 0x77, 0xbb, 0xdd, 0xee,
+};
+static gpd_t dma_gpd[2] __attribute__((aligned(64)));   // GPD + null GPD
+static bd_t dma_bd[MSDC_MAX_BD] __attribute__((aligned(64)));
+
+static int msdc_wait_busy(void);
+
+// Every command goes through here first, so this is where a deferred
+// write busy gets waited out. A timeout is kept for emmc_write_sync.
 void msdc_wait_cmd_ready(void) {
+    if (write_busy_pending) {
+        write_busy_pending = 0;
+        if (msdc_wait_busy() != 0) {
+            printf("Card busy after deferred write\n");
+            write_busy_failed = 1;
+        }
+    }
     while (msdc[SDC_STS] & 0x2);
 }
 
@@ -120,11 +440,56 @@ void msdc_clear_fifo(void) {
     while (msdc[MSDC_FIFOCS] & 0x80000000);
 }
 
-int msdc_wait_int(uint32_t mask, uint32_t timeout_val) {
-    while (timeout_val-- > 0) {
-        if (msdc[MSDC_INT] & mask) return 0;
+static void msdc_irq_handler(void) {
+    msdc[MSDC_INTEN] = 0;
+    msdc_irq_fired = 1;
+}
+
+// Sleep in WFI until one of `mask` is raised. INTEN only carries the
+// bits being waited for and is cleared by the handler, so a stray status
+// bit can't keep re-entering it. IRQs stay masked around the check so a
+// completion that lands before WFI still wakes it.
+static void msdc_irq_sleep(uint32_t mask, uint32_t start, uint32_t limit) {
+    msdc_irq_fired = 0;
+    msdc[MSDC_INTEN] = mask;
+    while (!(msdc[MSDC_INT] & mask)) {
+        uint32_t elapsed = timer_ticks() - start;
+        if (elapsed >= limit) break;
+        irq_wait(limit - elapsed);
+    }
+    msdc[MSDC_INTEN] = 0;
+
+    // Status came up but no interrupt arrived: routing is wrong, poll
+    if ((msdc[MSDC_INT] & mask) && !msdc_irq_fired) {
+        printf("MSDC IRQ not delivered, polling\n");
+        msdc_irq_on = 0;
     }
-    return -1;
+}
+
+// Prove the line once with a CMD0, which only raises CMDRDY, so a wrong
+// MSDC_IRQ_ID costs a millisecond here rather than a command timeout
+static void msdc_irq_probe(void) {
+    msdc_wait_cmd_ready();
+    msdc[MSDC_INT] = 0xFFFFFFFF;
+    msdc[SDC_ARG] = 0;
+    msdc[SDC_CMD] = 0;
+    msdc_irq_on = 1;
+    msdc_irq_sleep(INT_CMDRDY, timer_ticks(), timer_us_to_ticks(MSDC_IRQ_PROBE_US));
+    if (msdc_irq_on && !msdc_irq_fired) {
+        printf("MSDC IRQ probe timed out, polling\n");
+        msdc_irq_on = 0;
+    }
+}
+
+int msdc_wait_int(uint32_t mask, uint32_t timeout_us) {
+    uint32_t start = timer_ticks();
+    uint32_t limit = timer_us_to_ticks(timeout_us);
+
+    if (msdc_irq_on) msdc_irq_sleep(mask, start, limit);
+    while (!(msdc[MSDC_INT] & mask)) {
+        if (timer_ticks() - start >= limit) return -1;
+    }
+    return 0;
 }
 
 void msdc_drain_rxdata_fifo(void) { 
@@ -140,30 +505,972 @@ void msdc_drain_rxdata_fifo(void) {
         msdc[MSDC_INT] = 0xFFFFFFFF; // Clear interrupts
 }
 
+int emmc_set_xfer_mode(uint32_t mode) {
+    if (mode != EMMC_XFER_PIO && mode != EMMC_XFER_DMA_BASIC && mode != EMMC_XFER_DMA_DESC) return -1;
+    xfer_mode = mode;
+    return 0;
+}
+
+uint32_t emmc_get_xfer_mode(void) {
+    return xfer_mode;
+}
+
+// One burst is MSDC_FIFO_THD bytes: 16 FIFO accesses moved four words at
+// a time through r3-r6 with a single STM/LDM on the memory side.
+#define MSDC_BURST_WORDS (MSDC_FIFO_THD / 4)
+
+#define FIFO_LD4 "ldr r3, [%1]\n\tldr r4, [%1]\n\tldr r5, [%1]\n\tldr r6, [%1]\n\tstmia %0!, {r3-r6}\n\t"
+#define FIFO_ST4 "ldmia %0!, {r3-r6}\n\tstr r3, [%1]\n\tstr r4, [%1]\n\tstr r5, [%1]\n\tstr r6, [%1]\n\t"
+
+static inline uint32_t *msdc_fifo_read_burst(uint32_t *buf) {
+    asm volatile (FIFO_LD4 FIFO_LD4 FIFO_LD4 FIFO_LD4
+                  : "+r"(buf) : "r"(&msdc[MSDC_RXDATA]) : "r3", "r4", "r5", "r6", "memory");
+    return buf;
+}
+
+static inline const uint32_t *msdc_fifo_write_burst(const uint32_t *buf) {
+    asm volatile (FIFO_ST4 FIFO_ST4 FIFO_ST4 FIFO_ST4
+                  : "+r"(buf) : "r"(&msdc[MSDC_TXDATA]) : "r3", "r4", "r5", "r6", "memory");
+    return buf;
+}
+
+// Drain `words` words from the RX FIFO. FIFOCS is read once per batch of
+// whole bursts, only a sub-burst tail goes word by word. The timeout
+// restarts whenever data arrives so long multi-block transfers don't trip it.
+static uint32_t msdc_pio_read(uint32_t *buf, uint32_t words) {
+    uint32_t *p = buf;
+    uint32_t *end = buf + words;
+    uint32_t start = timer_ticks();
+    uint32_t limit = timer_us_to_ticks(MSDC_PIO_TIMEOUT_US);
+
+    while (p < end) {
+        uint32_t avail = (msdc[MSDC_FIFOCS] & MSDC_FIFOCS_RXCNT) / 4;
+        uint32_t left = end - p;
+        if (left >= MSDC_BURST_WORDS && avail >= MSDC_BURST_WORDS) {
+            for (; avail >= MSDC_BURST_WORDS && left >= MSDC_BURST_WORDS; avail -= MSDC_BURST_WORDS) {
+                p = msdc_fifo_read_burst(p);
+                left -= MSDC_BURST_WORDS;
+            }
+            start = timer_ticks();
+            continue;
+        }
+        if (left < MSDC_BURST_WORDS && avail >= left) {
+            while (p < end) *p++ = msdc[MSDC_RXDATA];
+            break;
+        }
+        if (msdc[MSDC_INT] & (INT_DATCRCERR | INT_DATTMO)) break;
+        if (timer_ticks() - start > limit) break;
+    }
+    return p - buf;
+}
+
+// Fill the TX FIFO with `words` words, same burst and timeout rules as above.
+static uint32_t msdc_pio_write(const uint32_t *buf, uint32_t words) {
+    const uint32_t *p = buf;
+    const uint32_t *end = buf + words;
+    uint32_t start = timer_ticks();
+    uint32_t limit = timer_us_to_ticks(MSDC_PIO_TIMEOUT_US);
+
+    while (p < end) {
+        uint32_t tx_count = (msdc[MSDC_FIFOCS] & MSDC_FIFOCS_TXCNT) >> 16;
+        uint32_t room = (tx_count < MSDC_FIFO_SZ) ? (MSDC_FIFO_SZ - tx_count) / 4 : 0;
+        uint32_t left = end - p;
+        if (left >= MSDC_BURST_WORDS && room >= MSDC_BURST_WORDS) {
+            for (; room >= MSDC_BURST_WORDS && left >= MSDC_BURST_WORDS; room -= MSDC_BURST_WORDS) {
+                p = msdc_fifo_write_burst(p);
+                left -= MSDC_BURST_WORDS;
+            }
+            start = timer_ticks();
+            continue;
+        }
+        if (left < MSDC_BURST_WORDS && room >= left) {
+            while (p < end) msdc[MSDC_TXDATA] = *p++;
+            break;
+        }
+        if (msdc[MSDC_INT] & (INT_DATCRCERR | INT_DATTMO)) break;
+        if (timer_ticks() - start > limit) break;
+    }
+    return p - buf;
+}
+
+// The DMA engines are started after the data command has been accepted.
+// The BROM leaves the D-cache off, so buffers and descriptors need no
+// maintenance, only ordering against the register writes.
+static void msdc_dma_start(void) {
+    asm volatile ("dsb" ::: "memory");
+    msdc[MSDC_DMA_CTRL] |= MSDC_DMA_CTRL_START;
+}
+
+static int msdc_dma_finish(void) {
+    int ret = -1;
+    uint32_t start = timer_ticks();
+    uint32_t limit = timer_us_to_ticks(MSDC_DMA_TIMEOUT_US);
+    while (timer_ticks() - start < limit) {
+        // A descriptor checksum error has no known INT bit here, it shows
+        // up as a DMA that never goes idle
+        if (msdc[MSDC_INT] & (INT_DATCRCERR | INT_DATTMO)) break;
+        if (!(msdc[MSDC_DMA_CFG] & MSDC_DMA_CFG_STS)) {
+            ret = 0;
+            break;
+        }
+    }
+
+    if (ret != 0) {
+        printf("DMA error\n");
+        printf("INT 0x%s\n", u32_to_str(msdc[MSDC_INT]));
+        printf("DMA_CA 0x%s\n", u32_to_str(msdc[MSDC_DMA_CA]));
+        msdc[MSDC_DMA_CTRL] |= MSDC_DMA_CTRL_STOP;
+        start = timer_ticks();
+        limit = timer_us_to_ticks(MSDC_DMA_STOP_TIMEOUT_US);
+        while (timer_ticks() - start < limit) {
+            if (!(msdc[MSDC_DMA_CFG] & MSDC_DMA_CFG_STS)) break;
+        }
+    }
+
+    asm volatile ("dsb" ::: "memory");
+    msdc[MSDC_DMA_CFG] &= ~MSDC_DMA_CFG_DECSEN;
+    msdc[MSDC_CFG] |= MSDC_CFG_PIO;
+    return ret;
+}
+
+static int msdc_dma_wait(void) {
+    msdc_dma_start();
+    return msdc_dma_finish();
+}
+
+// Basic DMA: one contiguous buffer, restarted by software per transfer.
+static void msdc_dma_setup(uint8_t *buf, uint32_t len) {
+    msdc[MSDC_CFG] &= ~MSDC_CFG_PIO;
+    msdc[MSDC_DMA_SA_HIGH] = 0;
+    msdc[MSDC_DMA_SA] = (uint32_t)buf;
+    msdc[MSDC_DMA_LEN] = len;
+    msdc[MSDC_DMA_CTRL] = (msdc[MSDC_DMA_CTRL] & ~(MSDC_DMA_CTRL_MODE | MSDC_DMA_CTRL_BRUSTSZ)) |
+                          MSDC_DMA_CTRL_LASTBUF | (MSDC_BRUST_64B << 12);
+}
+
+static int msdc_dma_transfer(uint8_t *buf, uint32_t len) {
+    msdc_dma_setup(buf, len);
+    return msdc_dma_wait();
+}
+
+// Descriptor checksum: all 16 header bytes must sum to 0xFF
+static uint8_t msdc_dma_chksum(const void *desc) {
+    const uint8_t *b = (const uint8_t *)desc;
+    uint32_t sum = 0;
+    for (int i = 0; i < 16; i++) sum += b[i];
+    return 0xFF - (uint8_t)sum;
+}
+
+// Descriptor DMA: one GPD pointing at a chain of BDs, one BD per segment.
+// The engine walks the whole chain for a single eMMC command without
+// any CPU help between segments. A null GPD (HWO=0) terminates the list.
+static int msdc_dma_desc_setup(const struct emmc_sg *sg, uint32_t nsg) {
+    if (nsg == 0 || nsg > MSDC_MAX_BD) return -1;
+
+    memset(dma_gpd, 0, sizeof(dma_gpd));
+    memset(dma_bd, 0, sizeof(dma_bd));
+
+    for (uint32_t i = 0; i < nsg; i++) {
+        dma_bd[i].next = (i + 1 < nsg) ? (uint32_t)&dma_bd[i + 1] : 0;
+        dma_bd[i].ptr = (uint32_t)sg[i].buf;
+        dma_bd[i].buflen = sg[i].num_sectors * 512;
+        dma_bd[i].eol = (i + 1 == nsg);
+        dma_bd[i].chksum = msdc_dma_chksum(&dma_bd[i]);
+    }
+
+    dma_gpd[0].hwo = 1;
+    dma_gpd[0].bdp = 1;
+    dma_gpd[0].next = (uint32_t)&dma_gpd[1];
+    dma_gpd[0].ptr = (uint32_t)&dma_bd[0];
+    dma_gpd[0].chksum = msdc_dma_chksum(&dma_gpd[0]);
+
+    msdc[MSDC_CFG] &= ~MSDC_CFG_PIO;
+    msdc[MSDC_DMA_SA_HIGH] = 0;
+    msdc[MSDC_DMA_SA] = (uint32_t)&dma_gpd[0];
+    msdc[MSDC_DMA_CFG] |= MSDC_DMA_CFG_DECSEN;
+    msdc[MSDC_DMA_CTRL] = (msdc[MSDC_DMA_CTRL] & ~(MSDC_DMA_CTRL_LASTBUF | MSDC_DMA_CTRL_BRUSTSZ)) |
+                          MSDC_DMA_CTRL_MODE | (MSDC_BRUST_64B << 12);
+    return 0;
+}
+
+static int msdc_dma_desc_transfer(const struct emmc_sg *sg, uint32_t nsg) {
+    if (msdc_dma_desc_setup(sg, nsg) != 0) return -1;
+    return msdc_dma_wait();
+}
+
+// Data phase of a multi-block transfer, PIO or DMA as selected. Several
+// segments always go through the descriptor engine when DMA is enabled.
+// Returns 0 once every byte has moved.
+static int msdc_data_xfer(const struct emmc_sg *sg, uint32_t nsg, int write) {
+    if (xfer_mode == EMMC_XFER_DMA_DESC || (xfer_mode == EMMC_XFER_DMA_BASIC && nsg > 1)) {
+        return msdc_dma_desc_transfer(sg, nsg);
+    }
+    if (xfer_mode == EMMC_XFER_DMA_BASIC) {
+        return msdc_dma_transfer(sg[0].buf, sg[0].num_sectors * 512);
+    }
+
+    for (uint32_t i = 0; i < nsg; i++) {
+        uint32_t words = sg[i].num_sectors * 128;
+        uint32_t done;
+        if (write) {
+            done = msdc_pio_write((const uint32_t *)sg[i].buf, words);
+        } else {
+            done = msdc_pio_read((uint32_t *)sg[i].buf, words);
+        }
+        if (done < words) {
+            printf("PIO stalled in segment 0x%s\n", u32_to_str(i));
+            printf("words 0x%s\n", u32_to_str(done));
+            return -1;
+        }
+    }
+    return 0;
+}
+
 int msdc_send_cmd(uint8_t cmd_idx, uint32_t arg, uint32_t flags) {
     msdc_wait_cmd_ready();
     msdc[MSDC_INT] = 0xFFFFFFFF;
     msdc[SDC_ARG] = arg;
     msdc[SDC_CMD] = cmd_idx | flags;
-    return msdc_wait_int(INT_CMDRDY, 100000);
+    if (msdc_wait_int(INT_CMDRDY, 100000) != 0) {
+        card_state = CARD_STATE_UNKNOWN;
+        return -1;
+    }
+    if ((flags & SDC_CMD_RSPTYP) == CMD_R1B_RESP) card_state = CARD_STATE_BUSY;
+    return 0;
 }
 
-int msdc_wait_card_ready(void) {
+// Wait for the card to release DAT0 after an R1b command or a write.
+// SDC_STS SDCBUSY covers the controller side of the same wait.
+// Counted in whole milliseconds so erase timeouts of minutes don't
+// overflow the tick arithmetic.
+static int msdc_wait_busy_ms(uint32_t timeout_ms) {
+    uint32_t start = timer_ticks();
+    uint32_t ms = timer_us_to_ticks(1000);
+    while (timeout_ms > 0) {
+        if (!(msdc[SDC_STS] & SDC_STS_SDCBUSY) && (msdc[MSDC_PS] & MSDC_PS_DAT0)) {
+            if (card_state == CARD_STATE_BUSY) card_state = CARD_STATE_TRAN;
+            return 0;
+        }
+        if (timer_ticks() - start >= ms) {
+            start += ms;
+            timeout_ms--;
+        }
+    }
+    card_state = CARD_STATE_UNKNOWN;
+    return -1;
+}
+
+static int msdc_wait_busy(void) {
+    return msdc_wait_busy_ms(MSDC_BUSY_TIMEOUT_MS);
+}
+
+// CMD13 until the card reports TRAN, regardless of the tracked state
+static int msdc_poll_card_status(void) {
     for (int i = 0; i < 1000; i++) {
+        cmd13_sent++;
         if (msdc_send_cmd(13, 0x00010000, CMD_R1_RESP) == 0) {
             uint32_t state = (msdc[SDC_RESP0] >> 9) & 0xF;
-            if (state == 4) return 0;
+            if (state == 4) {
+                card_state = CARD_STATE_TRAN;
+                return 0;
+            }
         }
         for (volatile int d = 0; d < 1000; d++);
     }
+    card_state = CARD_STATE_UNKNOWN;
     return -1;
 }
 
-void emmc_init(void) {
+int msdc_wait_card_ready(void) {
+    if (card_state == CARD_STATE_BUSY) msdc_wait_busy();
+    if (card_state == CARD_STATE_TRAN) {
+        cmd13_skipped++;
+        return 0;
+    }
+    return msdc_poll_card_status();
+}
+
+// Program CKMOD/CKDIV for the fastest bus clock not above hz, the same
+// way msdc_config_clock in stage2_static_orig/drivers/mmc.c does it.
+// DDR modes divide by 4*div on top of the SDR divider (mtk-sd).
+// Returns the resulting bus clock in Hz.
+static uint32_t msdc_set_clock(uint32_t hz, uint32_t clk_timing) {
+    uint32_t mode, div, sclk, hs400_div_dis = 0;
+
+    // HS200 runs SDR, the generic divider below covers it
+    if (clk_timing == EMMC_TIMING_DDR52 || clk_timing >= EMMC_TIMING_HS400) {
+        mode = (clk_timing == EMMC_TIMING_DDR52) ? 0x2 : 0x3;  // DDR / HS400
+        if (hz >= (MSDC_SRC_CLK >> 2)) {
+            div = 0;
+            sclk = MSDC_SRC_CLK >> 2;
+        } else {
+            div = (MSDC_SRC_CLK + ((hz << 3) - 1)) / (hz << 3);
+            if (div > 0xFFF) div = 0xFFF;
+            sclk = (MSDC_SRC_CLK >> 3) / div;
+        }
+        // HS400 at full rate bypasses the divider: src/2 on both edges
+        if (mode == 0x3 && hz >= (MSDC_SRC_CLK >> 1)) {
+            hs400_div_dis = 1;
+            sclk = MSDC_SRC_CLK >> 1;
+        }
+    } else if (hz >= MSDC_SRC_CLK) {
+        mode = 0x1;  // no divisor
+        div = 0;
+        sclk = MSDC_SRC_CLK;
+    } else {
+        mode = 0x0;  // use divisor
+        if (hz >= (MSDC_SRC_CLK >> 1)) {
+            div = 0;  // div = 0 means 1/2
+            sclk = MSDC_SRC_CLK >> 1;
+        } else {
+            div = (MSDC_SRC_CLK + ((hz << 2) - 1)) / (hz << 2);
+            if (div > 0xFFF) div = 0xFFF;
+            sclk = (MSDC_SRC_CLK >> 2) / div;
+        }
+    }
+
+    msdc[MSDC_CFG] = (msdc[MSDC_CFG] & ~(MSDC_CFG_CKMOD_HS400 | MSDC_CFG_CKMOD | MSDC_CFG_CKDIV)) |
+                     (hs400_div_dis << 22) | (mode << 20) | (div << 8);
+    for (int i = 0; i < 100000; i++) {
+        if (msdc[MSDC_CFG] & MSDC_CFG_CKSTB) break;
+    }
+
+    bus_clock = sclk;
+    return sclk;
+}
+
+uint32_t emmc_get_bus_clock(void) {
+    return bus_clock;
+}
+
+uint32_t emmc_get_timing(void) {
+    return timing;
+}
+
+// Upper bound for the next emmc_init, does not touch the current timing
+int emmc_set_max_timing(uint32_t t) {
+    if (t > EMMC_TIMING_HS400ES) return -1;
+    max_timing = t;
+    return 0;
+}
+
+uint32_t emmc_get_max_timing(void) {
+    return max_timing;
+}
+
+void emmc_get_tuning(struct emmc_tuning *t) {
+    *t = tuning;
+}
+
+// Taps from an earlier session, tried before sweeping on the next init
+void emmc_set_tuning(const struct emmc_tuning *t) {
+    tuning = *t;
+}
+
+// CMD6 SWITCH, write byte `index` of EXT_CSD. The CMD13 issued while
+// waiting also reports SWITCH_ERROR (card status bit 7). Leaves the
+// EXT_CSD cache alone, for action bytes like FLUSH_CACHE; emmc_switch
+// is the variant that invalidates it.
+static int emmc_switch_wait(uint8_t index, uint8_t value, uint32_t timeout_ms) {
+    uint32_t arg = 0x03000000 | ((uint32_t)index << 16) | ((uint32_t)value << 8);
+    if (msdc_send_cmd(6, arg, CMD_R1B_RESP) != 0) {
+        printf("CMD6 failed, EXT_CSD[0x%s]\n", u32_to_str(index));
+        return -1;
+    }
+
+    // SWITCH_ERROR only shows up in the status after the switch, so
+    // this is one place where CMD13 is always needed
+    msdc_wait_busy_ms(timeout_ms);
+    if (msdc_poll_card_status() != 0) {
+        printf("Card not ready after CMD6\n");
+        return -1;
+    }
+
+    if (msdc[SDC_RESP0] & (1 << 7)) {
+        printf("CMD6 SWITCH_ERROR, EXT_CSD[0x%s]\n", u32_to_str(index));
+        return -1;
+    }
+    return 0;
+}
+
+static int emmc_switch(uint8_t index, uint8_t value) {
+    ext_csd_valid = 0;
+    return emmc_switch_wait(index, value, MSDC_BUSY_TIMEOUT_MS);
+}
+
+// CMDQ_MODE_EN. Only queued tasks may move data while it is set, so the
+// legacy paths turn it off again (partition switch, EXT_CSD read). The
+// cached EXT_CSD is patched rather than dropped.
+static int emmc_cmdq_set(uint32_t on) {
+    if (emmc_switch_wait(EXT_CSD_CMDQ_MODE_EN, on ? 1 : 0, MSDC_BUSY_TIMEOUT_MS) != 0) {
+        printf("CMDQ mode switch failed\n");
+        return -1;
+    }
+    ((uint8_t *)ext_csd_buf)[EXT_CSD_CMDQ_MODE_EN] = on ? 1 : 0;
+    cmdq_on = on ? 1 : 0;
+    return 0;
+}
+
+static void msdc_set_bus_width(uint32_t width) {
+    uint32_t val = MSDC_BUS_1BITS;
+    if (width == 8) val = MSDC_BUS_8BITS;
+    else if (width == 4) val = MSDC_BUS_4BITS;
+    msdc[SDC_CFG] = (msdc[SDC_CFG] & ~SDC_CFG_BUSWIDTH) | (val << 16);
+}
+
+#if EMMC_BUS_TEST
+// CMD19 BUS_TEST_W / CMD14 BUS_TEST_R. The card answers with the
+// pattern inverted on every line it can see. Neither direction carries
+// a meaningful CRC, so CRC status is ignored here.
+static int msdc_bus_test(uint32_t width) {
+    uint32_t pattern[2] = { 0, 0 };
+    uint32_t readback[2] = { 0, 0 };
+    uint32_t len = (width == 8) ? 8 : 4;
+    uint32_t words = len / 4;
+
+    if (width == 8) pattern[0] = 0x0000AA55;
+    else pattern[0] = 0x0000005A;
+
+    // CMD19 - BUS_TEST_W
+    msdc_clear_fifo();
+    msdc[MSDC_INT] = 0xFFFFFFFF;
+    msdc[SDC_BLK_NUM] = 1;
+    if (msdc_send_cmd(19, 0, CMD_R1_RESP | CMD_SINGLE_BLK | CMD_WRITE | CMD_BLKLEN(len)) != 0) {
+        printf("CMD19 failed\n");
+        return -1;
+    }
+    for (uint32_t i = 0; i < words; i++) msdc[MSDC_TXDATA] = pattern[i];
+    msdc_wait_int(INT_XFER_COMPL | INT_DATCRCERR | INT_DATTMO, 100000);
+
+    // CMD14 - BUS_TEST_R
+    msdc_drain_rxdata_fifo();
+    if (msdc_send_cmd(14, 0, CMD_R1_RESP | CMD_SINGLE_BLK | CMD_BLKLEN(len)) != 0) {
+        printf("CMD14 failed\n");
+        return -1;
+    }
+    if (msdc_pio_read(readback, words) < words) {
+        printf("CMD14 data timeout\n");
+        msdc_drain_rxdata_fifo();
+        return -1;
+    }
+    msdc_wait_int(INT_XFER_COMPL | INT_DATCRCERR | INT_DATTMO, 100000);
+    msdc[MSDC_INT] = 0xFFFFFFFF;
+
+    // Only the first len/4 bytes carry the pattern
+    uint8_t *p = (uint8_t *)pattern;
+    uint8_t *r = (uint8_t *)readback;
+    for (uint32_t i = 0; i < len / 4; i++) {
+        if ((p[i] ^ r[i]) != 0xFF) {
+            printf("Bus test %s-bit mismatch: 0x%s\n", width == 8 ? "8" : "4", u32_to_str(readback[0]));
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+// Widest bus that survives the switch (and the bus test), narrowing on
+// failure. EXT_CSD BUS_WIDTH: 0 = 1-bit, 1 = 4-bit, 2 = 8-bit SDR.
+// PATCH_BIT0 already has EN_8BITSUP set by emmc_init.
+static uint32_t emmc_select_bus_width(void) {
+    static const uint32_t widths[2] = { 8, 4 };
+
+    for (int i = 0; i < 2; i++) {
+        uint32_t width = widths[i];
+        if (emmc_switch(183, width == 8 ? 2 : 1) != 0) continue;
+        msdc_set_bus_width(width);
+#if EMMC_BUS_TEST
+        if (msdc_bus_test(width) != 0) continue;
+#endif
+        return width;
+    }
+
+    emmc_switch(183, 0);
+    msdc_set_bus_width(1);
+    return 1;
+}
+
+static int msdc_read_stale(void) {
+    return msdc_state.part_pending || msdc_state.write_done || msdc_state.fifo_residue;
+}
+
+// A read went through: the stale conditions are consumed, apart from
+// anything the transfer itself left behind in the FIFO.
+static void msdc_read_done(void) {
+    msdc_state.part_pending = 0;
+    msdc_state.write_done = 0;
+    msdc_state.fifo_residue = (msdc[MSDC_FIFOCS] & MSDC_FIFOCS_RXCNT) != 0;
+}
+
+void emmc_get_stats(struct emmc_stats *st) {
+    st->discard_reads = discard_reads;
+    st->cmd13_sent = cmd13_sent;
+    st->cmd13_skipped = cmd13_skipped;
+    st->ext_csd_hits = ext_csd_hits;
+    st->ext_csd_fetches = ext_csd_fetches;
+    st->auto_cmd_sent = auto_cmd_sent;
+    st->auto_cmd_errors = auto_cmd_errors;
+    st->cache_flushes = cache_flushes;
+    st->packed_batches = packed_batches;
+    st->cmdq_tasks = cmdq_tasks;
+    st->pipe_emmc_bound = pipe_emmc_bound;
+    st->pipe_host_bound = pipe_host_bound;
+    st->pipe_wait_ticks = pipe_wait_ticks;
+    st->busy_deferred = busy_deferred;
+}
+
+int emmc_set_auto_cmd(uint32_t flags) {
+    if (flags & ~(EMMC_AUTO_CMD12 | EMMC_AUTO_CMD23)) return -1;
+    if (flags && !EMMC_AUTO_CMD_ALLOW) {
+        printf("Auto CMD is unverified on this MSDC\n");
+        return -1;
+    }
+    auto_cmd = flags;
+    return 0;
+}
+
+uint32_t emmc_get_auto_cmd(void) {
+    return auto_cmd;
+}
+
+// The auto command's R1 is latched in SDC_ACMD_RESP and checked here.
+// Its INT events are not told apart from the data ones (see INT_*).
+static int msdc_auto_cmd_check(uint8_t cmd) {
+    uint32_t resp = msdc[SDC_ACMD_RESP];
+    if (resp & R1_ERRORS) {
+        auto_cmd_errors++;
+        card_state = CARD_STATE_UNKNOWN;
+        printf("Auto CMD%d error\n", cmd);
+        printf("ACMD_RESP 0x%s\n", u32_to_str(resp));
+        return -1;
+    }
+    return 0;
+}
+
+// Single-block read for init-time commands (CMD8 now, more later).
+// No partition switch, the caller owns that. Card state follows the outcome.
+static int msdc_read_block(uint8_t cmd, uint32_t arg, uint32_t *buf, uint32_t len) {
+    uint32_t words = len / 4;
+
+    msdc_drain_rxdata_fifo();
+    msdc[SDC_BLK_NUM] = 1;
+    if (msdc_send_cmd(cmd, arg, CMD_R1_RESP | CMD_SINGLE_BLK | CMD_BLKLEN(len)) != 0) return -1;
+
+    uint32_t words_read = msdc_pio_read(buf, words);
+    msdc_wait_int(INT_XFER_COMPL | INT_DATCRCERR | INT_DATTMO, 100000);
+
+    uint32_t int_status = msdc[MSDC_INT];
+    msdc[MSDC_INT] = int_status;
+
+    if ((int_status & (INT_DATCRCERR | INT_DATTMO)) || words_read < words) {
+        msdc_drain_rxdata_fifo();
+        msdc_state.fifo_residue = 1;
+        card_state = CARD_STATE_UNKNOWN;
+        return -1;
+    }
+    msdc_read_done();
+    card_state = CARD_STATE_TRAN;
+    return 0;
+}
+
+// CMD8 into buf, same stale-first-read rule as every other read
+
+static int emmc_fetch_ext_csd(uint32_t *buf) {
+    if (cmdq_on && emmc_cmdq_set(0) != 0) return -1;
+    if (msdc_read_stale()) {
+        discard_reads++;
+        if (msdc_read_block(8, 0, discard_blk, 512) != 0) return -1;
+        if (msdc_wait_card_ready() != 0) return -1;
+    }
+    if (msdc_read_block(8, 0, buf, 512) != 0) return -1;
+    return msdc_wait_card_ready();
+}
+
+// Cached EXT_CSD, read from the card only when the cache is stale.
+// Returns NULL if the card could not be read.
+static const uint8_t *emmc_ext_csd(void) {
+    if (ext_csd_valid) {
+        ext_csd_hits++;
+        return (const uint8_t *)ext_csd_buf;
+    }
+
+    if (msdc_wait_card_ready() != 0) return NULL;
+    if (emmc_fetch_ext_csd(ext_csd_buf) != 0) return NULL;
+    ext_csd_valid = 1;
+    ext_csd_fetches++;
+    return (const uint8_t *)ext_csd_buf;
+}
+
+// Volatile cache: with CACHE_CTRL on, a write's busy ends once the data
+// is in the card's RAM. Only FLUSH_CACHE (or turning the cache off) makes
+// it durable, so callers flush at the points that must survive a reset.
+int emmc_flush_cache(void) {
+    if (!cache_on) return 0;
+    if (msdc_wait_card_ready() != 0) return -1;
+    cache_flushes++;
+    if (emmc_switch_wait(EXT_CSD_FLUSH_CACHE, 1, EMMC_FLUSH_TIMEOUT_MS) != 0) {
+        printf("Cache flush failed\n");
+        return -1;
+    }
+    return 0;
+}
+
+int emmc_set_cache(uint32_t enable) {
+    if (enable == cache_on) return 0;
+    if (enable) {
+        const uint8_t *ext_csd = emmc_ext_csd();
+        if (ext_csd == NULL) return -1;
+        uint32_t size = ext_csd[EXT_CSD_CACHE_SIZE] | (ext_csd[EXT_CSD_CACHE_SIZE + 1] << 8) |
+                        (ext_csd[EXT_CSD_CACHE_SIZE + 2] << 16) | ((uint32_t)ext_csd[EXT_CSD_CACHE_SIZE + 3] << 24);
+        if (size == 0) {
+            printf("Card has no cache\n");
+            return -1;
+        }
+        printf("Cache %d KiB on\n", size);
+    } else if (emmc_flush_cache() != 0) {
+        return -1;
+    }
+    if (msdc_wait_card_ready() != 0) return -1;
+    if (emmc_switch(EXT_CSD_CACHE_CTRL, enable ? 1 : 0) != 0) return -1;
+    cache_on = enable ? 1 : 0;
+    return 0;
+}
+
+uint32_t emmc_get_cache(void) {
+    return cache_on;
+}
+
+// Re-read EXT_CSD and compare the read-only properties segment (192+)
+// with the snapshot, the cheapest data-path check after a timing change.
+static int emmc_check_data_path(void) {
+    if (emmc_fetch_ext_csd(ext_csd_chk) != 0) return -1;
+    for (int i = 192 / 4; i < 128; i++) {
+        if (ext_csd_chk[i] != ext_csd_buf[i]) return -1;
+    }
+    return 0;
+}
+
+// Switch the card to High Speed timing (EXT_CSD HS_TIMING = 1) and the
+// bus to 52MHz. A card that refuses stays at legacy timing and ~26MHz.
+static void emmc_select_hs(void) {
+    if (emmc_switch(185, 1) == 0) {
+        msdc_set_clock(EMMC_CLK_HS, EMMC_TIMING_HS);
+        if (msdc_wait_card_ready() == 0) {
+            timing = EMMC_TIMING_HS;
+            return;
+        }
+        printf("Card lost at HS timing, back to legacy\n");
+        msdc_set_clock(EMMC_CLK_LEGACY, EMMC_TIMING_LEGACY);
+        emmc_switch(185, 0);
+    }
+    msdc_set_clock(EMMC_CLK_LEGACY, EMMC_TIMING_LEGACY);
+    timing = EMMC_TIMING_LEGACY;
+}
+
+// Reset the controller state machine after a failed transfer. Unlike
+// the full reset in emmc_init this keeps clock and pad configuration.
+static void msdc_reset(void) {
+    msdc[MSDC_CFG] |= MSDC_CFG_RST;
+    for (int retry = 5000; retry > 0; retry--) {
+        if ((msdc[MSDC_CFG] & MSDC_CFG_RST) == 0) break;
+    }
+    msdc_clear_fifo();
+    msdc[MSDC_INT] = 0xFFFFFFFF;
+    msdc_state.part_pending = 1;
+}
+
+static void msdc_set_rx_delay(uint32_t cmd_dly, uint32_t dat_dly) {
+    msdc[PAD_TUNE0] = (msdc[PAD_TUNE0] & ~(MSDC_PAD_TUNE0_CMDRDLY | MSDC_PAD_TUNE0_DATRRDLY)) |
+                      (cmd_dly << 16) | (dat_dly << 8);
+}
+
+// One CMD21 SEND_TUNING_BLOCK. Returns 0 when response and pattern are
+// both intact, -1 when only the response is, -2 when neither is.
+static int emmc_tuning_block(void) {
+    uint32_t len = (bus_width == 8) ? 128 : 64;
+    const uint8_t *pattern = (bus_width == 8) ? tuning_blk_8bit : tuning_blk_4bit;
+
+    msdc_drain_rxdata_fifo();
+    msdc[SDC_BLK_NUM] = 1;
+    if (msdc_send_cmd(21, 0, CMD_R1_RESP | CMD_SINGLE_BLK | CMD_BLKLEN(len)) != 0) {
+        msdc_reset();
+        return -2;
+    }
+    card_state = CARD_STATE_UNKNOWN;
+
+    uint32_t words_read = msdc_pio_read(tuning_blk, len / 4);
+    msdc_wait_int(INT_XFER_COMPL | INT_DATCRCERR | INT_DATTMO, 100000);
+
+    uint32_t int_status = msdc[MSDC_INT];
+    msdc[MSDC_INT] = int_status;
+
+    if ((int_status & (INT_DATCRCERR | INT_DATTMO)) || words_read < len / 4 ||
+        memcmp(tuning_blk, pattern, len) != 0) {
+        msdc_reset();
+        return -1;
+    }
+    card_state = CARD_STATE_TRAN;
+    return 0;
+}
+
+// Center of the longest run of passing taps, -1 if none passed
+static int msdc_pick_delay(uint32_t pass_map) {
+    int best_start = -1, best_len = 0;
+    int start = -1;
+
+    for (int i = 0; i <= MSDC_PAD_DELAY_MAX; i++) {
+        int pass = (i < MSDC_PAD_DELAY_MAX) && (pass_map & (1u << i));
+        if (pass && start < 0) start = i;
+        if (!pass && start >= 0) {
+            if (i - start > best_len) {
+                best_len = i - start;
+                best_start = start;
+            }
+            start = -1;
+        }
+    }
+    if (best_start < 0) return -1;
+    return best_start + best_len / 2;
+}
+
+// Sweep the command response delay first, the data delay only means
+// anything once responses come back clean. Saved taps are tried first.
+static int emmc_tune_hs200(void) {
+    uint32_t pass_map;
+    int cmd_dly, dat_dly;
+
+    if (tuning.valid && (tuning.timing == EMMC_TIMING_HS200 || tuning.timing == EMMC_TIMING_HS400)) {
+        msdc_set_rx_delay(tuning.cmd_dly, tuning.dat_dly);
+        if (emmc_tuning_block() == 0) return 0;
+        printf("Saved taps failed, retuning\n");
+    }
+
+    pass_map = 0;
+    for (uint32_t i = 0; i < MSDC_PAD_DELAY_MAX; i++) {
+        msdc_set_rx_delay(i, 0);
+        if (emmc_tuning_block() != -2) pass_map |= 1u << i;
+    }
+    cmd_dly = msdc_pick_delay(pass_map);
+    printf("CMD delay map 0x%s\n", u32_to_str(pass_map));
+    if (cmd_dly < 0) return -1;
+
+    pass_map = 0;
+    for (uint32_t i = 0; i < MSDC_PAD_DELAY_MAX; i++) {
+        msdc_set_rx_delay(cmd_dly, i);
+        if (emmc_tuning_block() == 0) pass_map |= 1u << i;
+    }
+    dat_dly = msdc_pick_delay(pass_map);
+    printf("DAT delay map 0x%s\n", u32_to_str(pass_map));
+    if (dat_dly < 0) return -1;
+
+    msdc_set_rx_delay(cmd_dly, dat_dly);
+    tuning.valid = 1;
+    tuning.timing = EMMC_TIMING_HS200;
+    tuning.cmd_dly = cmd_dly;
+    tuning.dat_dly = dat_dly;
+    return 0;
+}
+
+// HS200: SDR bus width is already set, HS_TIMING = 2, 200MHz, then
+// tune. On failure the card goes back to legacy timing so the caller
+// can continue down the HS path.
+static int emmc_select_hs200(void) {
+    if (bus_width == 1) return -1;
+
+    if (emmc_switch(185, 2) != 0) return -1;
+    msdc_set_clock(EMMC_CLK_HS200, EMMC_TIMING_HS200);
+
+    if (emmc_tune_hs200() == 0 && msdc_wait_card_ready() == 0 && emmc_check_data_path() == 0) {
+        timing = EMMC_TIMING_HS200;
+        return 0;
+    }
+
+    printf("HS200 tuning failed, back to legacy\n");
+    msdc[PAD_TUNE0] = MSDC_PAD_TUNE0_DEFAULT;
+    msdc_reset();
+    msdc_set_clock(EMMC_CLK_LEGACY, EMMC_TIMING_LEGACY);
+    emmc_switch(185, 0);
+    timing = EMMC_TIMING_LEGACY;
+    return -1;
+}
+
+// Strobe-sampled data path of the eMMC 5.0 block, as mtk-sd sets it up
+// for HS400 (msdc_prepare_hs400_tuning). Enhanced strobe also latches
+// command responses on the strobe.
+static void msdc_hs400_setup(int enhanced_strobe) {
+    msdc[PATCH_BIT0] &= ~MSDC_PB0_RD_DAT_SEL;
+    msdc[PATCH_BIT2] &= ~MSDC_PB2_CFGCRCSTS;        // must be 0 in HS400
+    msdc[EMMC50_CFG3] = (msdc[EMMC50_CFG3] & ~EMMC50_CFG3_OUTS_WR) | 2;
+    if (enhanced_strobe) {
+        msdc[EMMC50_CFG0] |= EMMC50_CFG_PADCMD_LATCHCK | EMMC50_CFG_CMD_RESP_SEL;
+        msdc[EMMC50_CFG1] |= EMMC50_CFG1_DSCFG;
+    }
+}
+
+static void msdc_set_ds_delay(uint32_t dly) {
+    msdc[PAD_DS_TUNE] = (msdc[PAD_DS_TUNE] & ~PAD_DS_TUNE_DLY1) | (dly << 2);
+}
+
+// HS400 has no tuning command. Sweep the data strobe delay with EXT_CSD
+// reads compared against the snapshot, as msdc_execute_hs400_tuning does.
+static int emmc_tune_hs400(uint32_t target) {
+    uint32_t pass_map = 0;
+    int ds_dly;
+
+    if (tuning.valid && tuning.timing == target) {
+        msdc_set_ds_delay(tuning.ds_dly);
+        if (emmc_check_data_path() == 0) return 0;
+        msdc_reset();
+        printf("Saved strobe delay failed, retuning\n");
+    }
+
+    for (uint32_t i = 0; i < MSDC_PAD_DELAY_MAX; i++) {
+        msdc_set_ds_delay(i);
+        if (emmc_check_data_path() == 0) pass_map |= 1u << i;
+        else msdc_reset();
+    }
+    ds_dly = msdc_pick_delay(pass_map);
+    printf("DS delay map 0x%s\n", u32_to_str(pass_map));
+    if (ds_dly < 0) return -1;
+
+    msdc_set_ds_delay(ds_dly);
+    tuning.valid = 1;
+    tuning.timing = target;
+    tuning.ds_dly = ds_dly;
+    return 0;
+}
+
+// HS200 (tuned) -> HS400. HS_TIMING has to drop to HS at <= 52MHz
+// before BUS_WIDTH can go to 8-bit DDR, then HS_TIMING = 3 and the host
+// follows with CKMOD 3 at 200MHz (JEDEC 5.0 6.6.2.3).
+static int emmc_select_hs400(void) {
+    if (timing != EMMC_TIMING_HS200 || bus_width != 8) return -1;
+
+    msdc_set_clock(EMMC_CLK_HS, EMMC_TIMING_HS);
+    if (emmc_switch(185, 1) != 0) return -1;
+    if (emmc_switch(183, 6) != 0) return -1;
+    if (emmc_switch(185, 3) != 0) return -1;
+
+    msdc_hs400_setup(0);
+    msdc_set_clock(EMMC_CLK_HS200, EMMC_TIMING_HS400);
+    if (msdc_wait_card_ready() != 0 || emmc_tune_hs400(EMMC_TIMING_HS400) != 0) return -1;
+
+    timing = EMMC_TIMING_HS400;
+    return 0;
+}
+
+// HS400 with Enhanced Strobe: straight from legacy, no HS200 tuning.
+// BUS_WIDTH bit 7 asks the card to drive the strobe during responses.
+static int emmc_select_hs400es(void) {
+    if (bus_width != 8) return -1;
+
+    if (emmc_switch(185, 1) != 0) return -1;
+    msdc_set_clock(EMMC_CLK_HS, EMMC_TIMING_HS);
+    if (emmc_switch(183, 0x86) != 0) return -1;
+    if (emmc_switch(185, 3) != 0) return -1;
+
+    msdc_hs400_setup(1);
+    msdc_set_clock(EMMC_CLK_HS200, EMMC_TIMING_HS400ES);
+    if (msdc_wait_card_ready() != 0 || emmc_tune_hs400(EMMC_TIMING_HS400ES) != 0) return -1;
+
+    timing = EMMC_TIMING_HS400ES;
+    return 0;
+}
+
+// DDR52 on top of HS: DDR BUS_WIDTH (5 = 4-bit, 6 = 8-bit), DDR clock
+// mode, DDR50CKD and RD_DAT_SEL cleared, the setup the commented-out
+// block in msdc_config_clock applies for CKMOD 2.
+static int emmc_select_ddr52(void) {
+    if (timing != EMMC_TIMING_HS || bus_width == 1) return -1;
+
+    if (emmc_switch(183, bus_width == 8 ? 6 : 5) != 0) return -1;
+
+    uint32_t patch_bit0 = msdc[PATCH_BIT0];
+    msdc[MSDC_IOCON] |= MSDC_IOCON_DDR50CKD;
+    msdc[PATCH_BIT0] = patch_bit0 & ~MSDC_PB0_RD_DAT_SEL;
+    msdc_set_clock(EMMC_CLK_HS, EMMC_TIMING_DDR52);
+
+    if (msdc_wait_card_ready() == 0 && emmc_check_data_path() == 0) {
+        timing = EMMC_TIMING_DDR52;
+        return 0;
+    }
+
+    printf("DDR52 data path check failed, back to HS\n");
+    msdc[MSDC_IOCON] &= ~MSDC_IOCON_DDR50CKD;
+    msdc[PATCH_BIT0] = patch_bit0;
+    msdc_set_clock(EMMC_CLK_HS, EMMC_TIMING_HS);
+    emmc_switch(183, bus_width == 8 ? 2 : 1);
+    return -1;
+}
+
+// Pick the fastest timing both EXT_CSD DEVICE_TYPE and *limit allow.
+// Without EXT_CSD only plain HS is attempted, as before. HS400 cannot
+// be unwound in place, so a failure there lowers *limit and returns -1
+// for emmc_init to start over.
+static int emmc_select_timing(uint32_t *limit) {
+    uint8_t card_type = EXT_CSD_CARD_TYPE_HS_52;
+    uint8_t strobe = 0;
+    const uint8_t *ext_csd = emmc_ext_csd();
+
+    if (ext_csd) {
+        card_type = ext_csd[196];
+        strobe = ext_csd[184];
+    } else {
+        printf("EXT_CSD read failed, HS only\n");
+    }
+
+    if (*limit >= EMMC_TIMING_HS400ES && (card_type & EXT_CSD_CARD_TYPE_HS400) &&
+        (strobe & EXT_CSD_STROBE_SUPPORT) && bus_width == 8) {
+        if (emmc_select_hs400es() == 0) return 0;
+        printf("HS400ES failed, retrying with HS400 max\n");
+        *limit = EMMC_TIMING_HS400;
+        return -1;
+    }
+
+    if (*limit >= EMMC_TIMING_HS200 && (card_type & EXT_CSD_CARD_TYPE_HS200)) {
+        if (emmc_select_hs200() == 0) {
+            if (*limit >= EMMC_TIMING_HS400 && (card_type & EXT_CSD_CARD_TYPE_HS400) && bus_width == 8) {
+                if (emmc_select_hs400() != 0) {
+                    printf("HS400 failed, retrying with HS200 max\n");
+                    *limit = EMMC_TIMING_HS200;
+                    return -1;
+                }
+            }
+            return 0;
+        }
+    }
+
+    if (*limit < EMMC_TIMING_HS || !(card_type & EXT_CSD_CARD_TYPE_HS_52)) {
+        msdc_set_clock(EMMC_CLK_LEGACY, EMMC_TIMING_LEGACY);
+        timing = EMMC_TIMING_LEGACY;
+        return 0;
+    }
+
+    emmc_select_hs();
+
+    if (*limit >= EMMC_TIMING_DDR52 && (card_type & EXT_CSD_CARD_TYPE_DDR_52)) {
+        emmc_select_ddr52();
+    }
+    return 0;
+}
+
+static const char *emmc_timing_name(uint32_t t) {
+    switch (t) {
+        case EMMC_TIMING_HS:    return "HS";
+        case EMMC_TIMING_DDR52: return "DDR52";
+        case EMMC_TIMING_HS200: return "HS200";
+        case EMMC_TIMING_HS400: return "HS400";
+        case EMMC_TIMING_HS400ES: return "HS400ES";
+        default:                return "legacy";
+    }
+}
+
+// Reset the controller and bring the card up to transfer state at the
+// fastest timing `*limit` allows. Returns -1 on failure, 1 when a timing
+// switch failed and lowered *limit so the caller can start over.
+static int emmc_init_card(uint32_t *limit) {
     int retry;
-    
-    printf("=== eMMC Init ===\n");
-    
+
     // Controller reset
     msdc[MSDC_CFG] |= 0xF;
     for (retry = 5000; retry > 0; retry--) {
@@ -171,10 +1478,12 @@ void emmc_init(void) {
     }
     
     msdc_clear_fifo();
+    // The EXT_CSD reads during init are the first after reset
+    msdc_state.part_pending = 1;
     
     // Hardware configuration
     msdc[MSDC_INT] = msdc[MSDC_INT];
-    msdc[PAD_TUNE0] = 0x202000;
+    msdc[PAD_TUNE0] = MSDC_PAD_TUNE0_DEFAULT;
     msdc[DAT_RD_DLY0] = 0;
     msdc[DAT_RD_DLY1] = 0;
     msdc[MSDC_IOCON] = 0;
@@ -186,6 +1495,8 @@ void emmc_init(void) {
     
     // eMMC 5.0 config
     msdc[EMMC50_CFG0] |= 0x10;
+    msdc[EMMC50_CFG0] &= ~(EMMC50_CFG_PADCMD_LATCHCK | EMMC50_CFG_CMD_RESP_SEL);
+    msdc[EMMC50_CFG1] &= ~EMMC50_CFG1_DSCFG;
     msdc[EMMC50_BLOCK_LEN] &= 0xFCFFFFFF;
     msdc[SDC_ADV_CFG0] |= 0x100000;
     
@@ -220,6 +1531,11 @@ void emmc_init(void) {
     // Interrupts
     msdc[MSDC_INT] = msdc[MSDC_INT];
     msdc[MSDC_INTEN] = 0x738;
+    if (MSDC_USE_IRQ && !msdc_irq_on && irq_register(MSDC_IRQ_ID, msdc_irq_handler) == 0) {
+        msdc_irq_probe();
+    }
+    // Only msdc_wait_int enables sources, for the duration of one wait
+    if (msdc_irq_on) msdc[MSDC_INTEN] = 0;
     
     printf("Controller configured\n");
     
@@ -238,40 +1554,79 @@ void emmc_init(void) {
     }
     if (retry == 0) {
         printf("CMD1 timeout!\n");
-        return;
+        return -1;
     }
     
     // CMD2 - ALL_SEND_CID
     if (msdc_send_cmd(2, 0, CMD_R2_RESP) != 0) {
         printf("CMD2 failed\n");
-        return;
+        return -1;
     }
     
     // CMD3 - SET_RELATIVE_ADDR
     if (msdc_send_cmd(3, 0x00010000, CMD_R1_RESP) != 0) {
         printf("CMD3 failed\n");
-        return;
+        return -1;
     }
     
     // CMD7 - SELECT_CARD
     if (msdc_send_cmd(7, 0x00010000, CMD_R1B_RESP) != 0) {
         printf("CMD7 failed\n");
-        return;
+        return -1;
     }
     
-    // Increase clock to 25MHz
-    msdc[MSDC_CFG] = (msdc[MSDC_CFG] & 0xFFC000FF) | (0x4 << 8);
-    for (int i = 0; i < 100000; i++) {
-        if (msdc[MSDC_CFG] & 0x80) break;
-    }
+    // Legacy timing, up to 26MHz
+    timing = EMMC_TIMING_LEGACY;
+    msdc_set_clock(EMMC_CLK_LEGACY, EMMC_TIMING_LEGACY);
     
     if (msdc_wait_card_ready() != 0) {
         printf("Card not ready!\n");
-        return;
+        return -1;
+    }
+
+    bus_width = emmc_select_bus_width();
+    printf("Bus width %s-bit\n", bus_width == 8 ? "8" : (bus_width == 4 ? "4" : "1"));
+
+    return emmc_select_timing(limit) == 0 ? 0 : 1;
+}
+
+void emmc_init(void) {
+    printf("=== eMMC Init ===\n");
+    // Don't let a re-init drop cached writes from a working card
+    // A reset in the middle of programming would lose the last write
+    emmc_write_sync();
+    if (cache_on && card_state != CARD_STATE_UNKNOWN) emmc_flush_cache();
+    if (cmdq_on && card_state != CARD_STATE_UNKNOWN) emmc_cmdq_set(0);
+    cmdq_on = 0;
+    card_state = CARD_STATE_UNKNOWN;
+    ext_csd_valid = 0;
+
+    // A downgrade after a failed HS400/HS400ES switch only holds for this
+    // init, max_timing stays as set
+    uint32_t limit = max_timing;
+    int ret;
+    int attempt = 1;
+    while ((ret = emmc_init_card(&limit)) > 0 && attempt < EMMC_INIT_ATTEMPTS) attempt++;
+    if (ret != 0) return;
+    printf("Timing %s, bus clock %d kHz\n", emmc_timing_name(timing), bus_clock / 1000);
+
+    // Refill the cache at the final timing, the switches above cleared it
+    if (emmc_ext_csd() == NULL) {
+        printf("EXT_CSD read failed!\n");
+    }
+
+    // EXP_EVENTS_CTRL is back to 0 as well
+    packed_events_on = 0;
+
+    // Reset clears CACHE_CTRL, put it back if the host asked for it
+    if (cache_on) {
+        cache_on = 0;
+        if (emmc_set_cache(1) != 0) printf("Cache re-enable failed\n");
     }
     
     printf("=== eMMC Init Complete ===\n");
     current_partition = EMMC_PART_USER;
+    msdc_state.part_pending = 1;
     
     // Drain any leftover data in FIFO from init sequence
     msdc_clear_fifo();
@@ -281,7 +1636,8 @@ void emmc_init(void) {
     msdc[MSDC_INT] = 0xFFFFFFFF;
 }
 
-int emmc_switch_partition(uint32_t partition) {
+// PARTITION_CONFIG only, the command queue must already be off
+static int emmc_set_partition(uint32_t partition) {
     if (partition == current_partition) return 0;
     
     uint8_t part_config;
@@ -292,18 +1648,34 @@ int emmc_switch_partition(uint32_t partition) {
         default: return -1;
     }
     
-    uint32_t arg = 0x03B30000 | (part_config << 8);
-    if (msdc_send_cmd(6, arg, CMD_R1B_RESP) != 0) {
+    // EXT_CSD PARTITION_CONFIG
+    if (emmc_switch(179, part_config) != 0) {
         printf("Partition switch failed\n");
         return -1;
     }
-    
+    
+    current_partition = partition;
+    msdc_state.part_pending = 1;
+    return 0;
+}
+
+// Entry point of every legacy data path, which can't run in CMDQ mode
+int emmc_switch_partition(uint32_t partition) {
+    if (cmdq_on && emmc_cmdq_set(0) != 0) return -1;
+    return emmc_set_partition(partition);
+}
+
+// One single-block read plus the card-ready wait, with error reporting
+static int emmc_read_single(uint8_t cmd, uint32_t arg, uint32_t *buffer) {
+    if (msdc_read_block(cmd, arg, buffer, 512) != 0) {
+        printf("CMD%d read error\n", cmd);
+        return -1;
+    }
+
     if (msdc_wait_card_ready() != 0) {
-        printf("Card not ready after switch\n");
+        printf("Card not ready after read\n");
         return -1;
     }
-    
-    current_partition = partition;
     return 0;
 }
 
@@ -317,58 +1689,166 @@ int emmc_read_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer)
     }
     
     // First read after partition switch or write returns stale data.
-    // Do every read twice and discard the first result.
-    for (int attempt = 0; attempt < 2; attempt++) {
+    // Only then is a throw-away read issued ahead of the real one.
+    if (msdc_read_stale()) {
+        discard_reads++;
+        if (emmc_read_single(17, sector_num, discard_blk) != 0) return -1;
+    }
+
+    // CMD17 - READ_SINGLE_BLOCK
+    return emmc_read_single(17, sector_num, buffer);
+}
+
+// Everything of a CMD18 read up to its data phase. Picks the auto
+// command mode, returned through acmd for emmc_read_end.
+static int emmc_read_begin(uint32_t partition, uint32_t start_sector, uint32_t num_sectors, uint32_t *acmd_out) {
+    if (emmc_switch_partition(partition) != 0) return -1;
+
+    if (msdc_wait_card_ready() != 0) {
+        printf("Card not ready before multi read\n");
+        return -1;
+    }
+
+    // Same stale-first-read rule as emmc_read_sector
+    if (msdc_read_stale()) {
+        discard_reads++;
+        if (emmc_read_single(17, start_sector, discard_blk) != 0) return -1;
+    }
+
+    // Prefer a closed-ended read with auto CMD23 (count from SDC_BLK_NUM),
+    // else let the controller send the CMD12. Without either we stop it.
+    uint32_t acmd = 0;
+    if ((auto_cmd & EMMC_AUTO_CMD23) && num_sectors <= 0xFFFF) {
+        acmd = CMD_AUTO_CMD23;
+    } else if (auto_cmd & EMMC_AUTO_CMD12) {
+        acmd = CMD_AUTO_CMD12;
+    }
+
+    msdc_drain_rxdata_fifo();
+    msdc[SDC_BLK_NUM] = num_sectors;
+
+    // CMD18 - READ_MULTIPLE_BLOCK
+    if (acmd) auto_cmd_sent++;
+    if (msdc_send_cmd(18, start_sector, CMD_R1_RESP | CMD_MULTI_BLK | CMD_BLKLEN(512) | acmd) != 0) {
+        printf("CMD18 failed\n");
+        msdc[SDC_BLK_NUM] = 1;
+        return -1;
+    }
+    *acmd_out = acmd;
+    return 0;
+}
+
+// Stop and error handling once the data phase of a CMD18 read is over
+static int emmc_read_end(uint32_t acmd, int xfer_failed) {
+    uint32_t int_status = msdc[MSDC_INT];
+    msdc[MSDC_INT] = int_status;
+
+    int stop_failed;
+    if (acmd == CMD_AUTO_CMD12) {
+        // The controller sends CMD12 itself, SDCBUSY holds until it's done
+        card_state = CARD_STATE_BUSY;
+        stop_failed = msdc_wait_busy() != 0 || msdc_auto_cmd_check(12) != 0;
+    } else if (acmd == CMD_AUTO_CMD23) {
+        stop_failed = msdc_auto_cmd_check(23);
+    } else {
+        // CMD12 - STOP_TRANSMISSION, the card streams until told otherwise
+        stop_failed = msdc_send_cmd(12, 0, CMD_R1B_RESP | CMD_STOP);
+        if (stop_failed) printf("CMD12 failed\n");
+    }
+    msdc[SDC_BLK_NUM] = 1;
+
+    if ((int_status & (INT_DATCRCERR | INT_DATTMO)) || xfer_failed) {
+        printf("Multi read error\n");
+        printf("INT 0x%s\n", u32_to_str(int_status));
         msdc_drain_rxdata_fifo();
+        msdc_state.fifo_residue = 1;
+        // An aborted auto-command transfer may leave the card streaming
+        if (acmd) msdc_send_cmd(12, 0, CMD_R1B_RESP | CMD_STOP);
+        msdc_wait_card_ready();
+        return -1;
+    }
+    msdc_read_done();
 
-        // CMD17 - READ_SINGLE_BLOCK
-        if (msdc_send_cmd(17, sector_num, CMD_R1_RESP | CMD_SINGLE_BLK | CMD_BLKLEN(512)) != 0) {
-            printf("CMD17 failed\n");
-            return -1;
-        }
-        
-        // Wait for data to start arriving
-        uint32_t timeout_val = 100000;
-        while (timeout_val-- > 0) {
-            if ((msdc[MSDC_FIFOCS] & 0xFF) > 0) break;
-            if (msdc[MSDC_INT] & INT_DATA_BITS) break;
-        }
-        
-        // Read 128 words (512 bytes) from FIFO
-        int words_read = 0;
-        timeout_val = 100000;
-        
-        while (timeout_val-- > 0 && words_read < 128) {
-            uint32_t fifo_count = msdc[MSDC_FIFOCS] & 0xFF;
-            while (fifo_count >= 4 && words_read < 128) {
-                buffer[words_read++] = msdc[MSDC_RXDATA];
-                fifo_count = msdc[MSDC_FIFOCS] & 0xFF;
-            }
-            if (msdc[MSDC_INT] & INT_XFER_COMPL) break;
-        }
-        
-        uint32_t int_status = msdc[MSDC_INT];
-        msdc[MSDC_INT] = int_status;
+    if (stop_failed) return -1;
 
-        if ((int_status & (INT_DATCRCERR | INT_DATTMO)) || words_read < 128) {
-            printf("Read error\n");
-            printf("INT 0x%s\n", u32_to_str(int_status));
-            printf("words_read 0x%s\n", u32_to_str(words_read));
-            return -1;
-        }
+    // CMD12 is R1b, DAT0 tells when the card is back in TRAN
+    if (msdc_wait_busy() != 0) {
+        printf("Card busy after multi read\n");
+        return -1;
+    }
 
-        // Wait for card ready before next attempt or return
-        if (msdc_wait_card_ready() != 0) {
-            printf("Card not ready after read\n");
-            return -1;
-        }
+    return 0;
+}
+
+int emmc_read_sg(uint32_t partition, uint32_t start_sector, const struct emmc_sg *sg, uint32_t nsg) {
+    // Segment buffers must be word aligned, data moves 32 bits at a time
+    uint32_t num_sectors = 0;
+    for (uint32_t i = 0; i < nsg; i++) num_sectors += sg[i].num_sectors;
+
+    if (num_sectors == 0) return 0;
+    if (nsg > MSDC_MAX_BD) return -1;
+    if (num_sectors == 1) return emmc_read_sector(partition, start_sector, (uint32_t *)sg[0].buf);
+
+    uint32_t acmd;
+    if (emmc_read_begin(partition, start_sector, num_sectors, &acmd) != 0) return -1;
 
-        // First iteration is dummy read, discard and read again
+    // Move the data continuously across block and segment boundaries
+    int xfer_failed = msdc_data_xfer(sg, nsg, 0);
+    return emmc_read_end(acmd, xfer_failed);
+}
+
+// Start a read and return while DMA moves its data, so the caller can
+// ship the previous buffer meanwhile. Nothing else may touch the card
+// until emmc_read_wait. PIO needs the CPU for the data, so in PIO mode
+// (or for a single sector) the read runs to completion right here.
+// Returns 0 when emmc_read_wait has a result to collect.
+int emmc_read_async(uint32_t partition, uint32_t start_sector, uint32_t num_sectors, uint8_t *buffer) {
+    if (read_async.active) return -1;
+
+    if (xfer_mode == EMMC_XFER_PIO || num_sectors < 2) {
+        read_async.dma = 0;
+        read_async.ret = emmc_read_multi_sector(partition, start_sector, num_sectors, buffer);
+        read_async.active = 1;
+        return 0;
     }
-    
+
+    if (emmc_read_begin(partition, start_sector, num_sectors, &read_async.acmd) != 0) return -1;
+    if (xfer_mode == EMMC_XFER_DMA_DESC) {
+        struct emmc_sg sg = { buffer, num_sectors };
+        msdc_dma_desc_setup(&sg, 1);
+    } else {
+        msdc_dma_setup(buffer, num_sectors * 512);
+    }
+    msdc_dma_start();
+    read_async.dma = 1;
+    read_async.active = 1;
     return 0;
 }
 
+// Finish the read started by emmc_read_async. Counts whether the DMA was
+// still running (the card is the slow side) or already done (the caller
+// is), and how long the wait took.
+int emmc_read_wait(void) {
+    if (!read_async.active) return -1;
+    read_async.active = 0;
+    if (!read_async.dma) return read_async.ret;
+
+    if (msdc[MSDC_DMA_CFG] & MSDC_DMA_CFG_STS) {
+        pipe_emmc_bound++;
+    } else {
+        pipe_host_bound++;
+    }
+    uint32_t start = timer_ticks();
+    int xfer_failed = msdc_dma_finish();
+    pipe_wait_ticks += timer_ticks() - start;
+    return emmc_read_end(read_async.acmd, xfer_failed);
+}
+
+int emmc_read_multi_sector(uint32_t partition, uint32_t start_sector, uint32_t num_sectors, uint8_t *buffer) {
+    struct emmc_sg sg = { buffer, num_sectors };
+    return emmc_read_sg(partition, start_sector, &sg, 1);
+}
+
 int emmc_write_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer) {
     if (emmc_switch_partition(partition) != 0) return -1;
     
@@ -388,6 +1868,8 @@ int emmc_write_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer)
 
     // CMD24 - WRITE_SINGLE_BLOCK
     msdc_wait_cmd_ready();
+    msdc_state.write_done = 1;
+    card_state = CARD_STATE_UNKNOWN;
     msdc[SDC_ARG] = sector_num;
     msdc[SDC_CMD] = 24 | CMD_R1_RESP | CMD_SINGLE_BLK | CMD_WRITE | CMD_BLKLEN(512);
 
@@ -401,7 +1883,7 @@ int emmc_write_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer)
     //printf("CMD24 INT 0x%s\n", u32_to_str(msdc[MSDC_INT]));
 
     // Check card accepted write command
-    if (msdc[SDC_RESP0] & 0xFDF90008) {
+    if (msdc[SDC_RESP0] & R1_ERRORS) {
         printf("CMD24 error in response\n");
         printf("RESP0 0x%s\n", u32_to_str(msdc[SDC_RESP0]));
         return -1;
@@ -409,19 +1891,9 @@ int emmc_write_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer)
     
     msdc[MSDC_INT] = INT_CMDRDY;  // Clear command done, keep others
     
-    // Write 128 words to FIFO, checking FIFO space
-    int words_written = 0;
-    uint32_t timeout_val = 100000;
+    // Write 128 words to FIFO in threshold bursts
+    uint32_t words_written = msdc_pio_write(buffer, 128);
 
-    while (timeout_val-- > 0 && words_written < 128) {
-        // FIFOCS bits [23:16] = TXCNT (bytes in TX FIFO)
-        // FIFO is 128 bytes, so wait until there's space
-        uint32_t tx_count = (msdc[MSDC_FIFOCS] >> 16) & 0xFF;
-        if (tx_count < 128) {  // Room for more data
-            msdc[MSDC_TXDATA] = buffer[words_written++];
-        }
-    }
-    
     //printf("Words written 0x%s\n", u32_to_str(words_written));
 
     if (words_written < 128) {
@@ -429,19 +1901,15 @@ int emmc_write_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer)
         return -1;
     }
 
-    // Wait for transfer complete
-    timeout_val = 1000000;  // Longer timeout for write
-    while (timeout_val-- > 0) {
-        uint32_t int_status = msdc[MSDC_INT];
-        if (int_status & INT_XFER_COMPL) break;
-        if (int_status & (INT_DATCRCERR | INT_DATTMO)) {
-            printf("Write data error\n");
-            printf("INT 0x%s\n", u32_to_str(int_status));
-            return -1;
-        }
+    // Wait for transfer complete, longer timeout for write
+    if (msdc_wait_int(INT_XFER_COMPL | INT_DATCRCERR | INT_DATTMO, MSDC_WRITE_TIMEOUT_US) == 0 &&
+        !(msdc[MSDC_INT] & INT_XFER_COMPL)) {
+        printf("Write data error\n");
+        printf("INT 0x%s\n", u32_to_str(msdc[MSDC_INT]));
+        return -1;
     }
 
-    if (timeout_val == 0) {
+    if (!(msdc[MSDC_INT] & INT_XFER_COMPL)) {
         printf("Write timeout waiting for XFER_COMPL\n");
         printf("MSDC_INT 0x%s\n", u32_to_str(msdc[MSDC_INT]));
         printf("SDC_STS 0x%s\n", u32_to_str(msdc[SDC_STS]));
@@ -452,8 +1920,9 @@ int emmc_write_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer)
     uint32_t int_status = msdc[MSDC_INT];
     msdc[MSDC_INT] = int_status;
     
-    // Wait for card to finish programming
-    if (msdc_wait_card_ready() != 0) {
+    // Wait for card to finish programming (DAT0 busy)
+    card_state = CARD_STATE_BUSY;
+    if (msdc_wait_busy() != 0) {
         printf("Card busy after write\n");
         return -1;
     }
@@ -462,68 +1931,491 @@ int emmc_write_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer)
     return 0;
 }
 
-int emmc_read_ext_csd(uint8_t *buffer) {
-    uint32_t *buf32 = (uint32_t*)buffer;
+// CMD23, CMD25 and the data phase of one closed-ended write. blk_arg is
+// the CMD23 argument, not sent when the controller issues it (acmd).
+// Partition and card readiness are the caller's.
+static int emmc_write_run(uint32_t address, uint32_t blk_arg, uint32_t acmd,
+                          const struct emmc_sg *sg, uint32_t nsg, uint32_t num_sectors) {
+    msdc_state.write_done = 1;
+    if (!acmd) {
+        if (msdc_send_cmd(23, blk_arg, CMD_R1_RESP) != 0) {
+            printf("CMD23 failed\n");
+            return -1;
+        }
+    }
+
+    msdc_clear_fifo();
+    msdc[MSDC_INT] = 0xFFFFFFFF;
+    msdc[SDC_BLK_NUM] = num_sectors;
+
+    // CMD25 - WRITE_MULTIPLE_BLOCK
+    msdc_wait_cmd_ready();
+    card_state = CARD_STATE_UNKNOWN;
+    msdc[SDC_ARG] = address;
+    if (acmd) auto_cmd_sent++;
+    msdc[SDC_CMD] = 25 | CMD_R1_RESP | CMD_MULTI_BLK | CMD_WRITE | CMD_BLKLEN(512) | acmd;
+
+    if (msdc_wait_int(INT_CMDRDY, 100000) != 0) {
+        printf("CMD25 timeout\n");
+        msdc[SDC_BLK_NUM] = 1;
+        return -1;
+    }
+
+    // The controller sent CMD23 ahead of CMD25
+    if (acmd && msdc_auto_cmd_check(23) != 0) {
+        msdc[SDC_BLK_NUM] = 1;
+        msdc_send_cmd(12, 0, CMD_R1B_RESP | CMD_STOP);
+        msdc_wait_card_ready();
+        return -1;
+    }
+
+    if (msdc[SDC_RESP0] & R1_ERRORS) {
+        printf("CMD25 error in response\n");
+        printf("RESP0 0x%s\n", u32_to_str(msdc[SDC_RESP0]));
+        msdc[SDC_BLK_NUM] = 1;
+        return -1;
+    }
+
+    msdc[MSDC_INT] = INT_CMDRDY;
+
+    // Stream every block to the card back to back
+    if (msdc_data_xfer(sg, nsg, 1) != 0) {
+        printf("Multi write data phase failed\n");
+        printf("INT 0x%s\n", u32_to_str(msdc[MSDC_INT]));
+        msdc[SDC_BLK_NUM] = 1;
+        msdc_send_cmd(12, 0, CMD_R1B_RESP | CMD_STOP);
+        msdc_wait_card_ready();
+        return -1;
+    }
+
+    // Wait for the last block's CRC status
+    if (msdc_wait_int(INT_XFER_COMPL | INT_DATCRCERR | INT_DATTMO, MSDC_WRITE_TIMEOUT_US) == 0 &&
+        !(msdc[MSDC_INT] & INT_XFER_COMPL)) {
+        printf("Multi write data error\n");
+        printf("INT 0x%s\n", u32_to_str(msdc[MSDC_INT]));
+        msdc[SDC_BLK_NUM] = 1;
+        msdc_send_cmd(12, 0, CMD_R1B_RESP | CMD_STOP);
+        msdc_wait_card_ready();
+        return -1;
+    }
+
+    msdc[SDC_BLK_NUM] = 1;
+
+    if (!(msdc[MSDC_INT] & INT_XFER_COMPL)) {
+        printf("Multi write timeout waiting for XFER_COMPL\n");
+        printf("MSDC_INT 0x%s\n", u32_to_str(msdc[MSDC_INT]));
+        return -1;
+    }
+
+    uint32_t int_status = msdc[MSDC_INT];
+    msdc[MSDC_INT] = int_status;
+
+    // CMD23 already told the card where the transfer ends, no CMD12.
+    // The whole run is programmed as one operation.
+    card_state = CARD_STATE_BUSY;
+    if (EMMC_DEFER_BUSY) {
+        busy_deferred++;
+        write_busy_pending = 1;
+        return 0;
+    }
+    if (msdc_wait_busy() != 0) {
+        printf("Card busy after multi write\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int emmc_write_sg(uint32_t partition, uint32_t start_sector, const struct emmc_sg *sg, uint32_t nsg, int reliable) {
+    // Segment buffers must be word aligned, data moves 32 bits at a time
+    uint32_t num_sectors = 0;
+    for (uint32_t i = 0; i < nsg; i++) num_sectors += sg[i].num_sectors;
+
+    if (num_sectors == 0) return 0;
+    if (num_sectors > 0xFFFF) return -1;  // CMD23 block count is 16 bits
+    if (nsg > MSDC_MAX_BD) return -1;
+
+    if (emmc_switch_partition(partition) != 0) return -1;
 
-    // Ensure card is ready before issuing read command
     if (msdc_wait_card_ready() != 0) {
-        printf("Card not ready for EXT_CSD read\n");
+        printf("Card not ready before multi write\n");
         return -1;
     }
 
-    // First read after partition switch or write returns stale data.
-    // Do every read twice and discard the first result.
-    for (int attempt = 0; attempt < 2; attempt++) {
-        msdc_drain_rxdata_fifo();
+    // CMD23 - SET_BLOCK_COUNT, bit 31 requests a reliable write. Auto
+    // CMD23 takes the count from SDC_BLK_NUM and can't carry that flag,
+    // so reliable writes keep the explicit command.
+    uint32_t acmd = ((auto_cmd & EMMC_AUTO_CMD23) && !reliable) ? CMD_AUTO_CMD23 : 0;
+    return emmc_write_run(start_sector, num_sectors | (reliable ? 0x80000000 : 0), acmd, sg, nsg, num_sectors);
+}
+
+// Wait out a deferred write busy now. Returns -1 if that write, or any
+// deferred write since the last call, never left busy.
+int emmc_write_sync(void) {
+    msdc_wait_cmd_ready();
+    if (write_busy_failed) {
+        write_busy_failed = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int emmc_write_multi_sector(uint32_t partition, uint32_t start_sector, uint32_t num_sectors, uint8_t *buffer, int reliable) {
+    struct emmc_sg sg = { buffer, num_sectors };
+    return emmc_write_sg(partition, start_sector, &sg, 1, reliable);
+}
 
-        // CMD8 - SEND_EXT_CSD
-        if (msdc_send_cmd(8, 0, CMD_R1_RESP | CMD_SINGLE_BLK | CMD_BLKLEN(512)) != 0) {
-            printf("CMD8 failed\n");
+// Several short writes at unrelated addresses as one CMD23/CMD25: a
+// header block lists (count, address) per entry, then the entries' data
+// follows back to back. Cards without packed support, or batches larger
+// than MAX_PACKED_WRITES, get one closed-ended write per entry instead.
+// On failure *fail_index is the 1-based entry the card reported, 0 if
+// it didn't name one.
+int emmc_write_packed(uint32_t partition, const struct emmc_packed_entry *e, uint32_t n,
+                      uint8_t *data, uint32_t *fail_index) {
+    *fail_index = 0;
+    if (n == 0) return 0;
+    if (n > EMMC_PACKED_MAX_ENTRIES) return -1;
+
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (e[i].num_sectors == 0) return -1;
+        total += e[i].num_sectors;
+    }
+    if (total + 1 > 0xFFFF) return -1;  // CMD23 block count is 16 bits
+
+    const uint8_t *ext_csd = emmc_ext_csd();
+    if (ext_csd == NULL) return -1;
+    uint32_t max_packed = (ext_csd[EXT_CSD_REV] >= 6) ? ext_csd[EXT_CSD_MAX_PACKED_WRITES] : 0;
+
+    if (n == 1 || n > max_packed) {
+        uint8_t *p = data;
+        for (uint32_t i = 0; i < n; i++) {
+            if (emmc_write_multi_sector(partition, e[i].sector, e[i].num_sectors, p, 0) != 0 ||
+                emmc_write_sync() != 0) {
+                *fail_index = i + 1;
+                return -1;
+            }
+            p += e[i].num_sectors * 512;
+        }
+        return 0;
+    }
+
+    // Have entry failures raised as EXCEPTION_EVENT in the card status
+    if (!packed_events_on) {
+        if (emmc_switch(EXT_CSD_EXP_EVENTS_CTRL, EXT_CSD_PACKED_EVENT_EN) != 0) return -1;
+        packed_events_on = 1;
+    }
+
+    if (emmc_switch_partition(partition) != 0) return -1;
+
+    if (msdc_wait_card_ready() != 0) {
+        printf("Card not ready before packed write\n");
+        return -1;
+    }
+
+    memset(packed_hdr, 0, sizeof(packed_hdr));
+    packed_hdr[0] = (n << 16) | (PACKED_CMD_WR << 8) | PACKED_CMD_VER;
+    for (uint32_t i = 0; i < n; i++) {
+        packed_hdr[(i + 1) * 2] = e[i].num_sectors;
+        packed_hdr[(i + 1) * 2 + 1] = e[i].sector;
+    }
+
+    struct emmc_sg sg[2] = {
+        { (uint8_t *)packed_hdr, 1 },
+        { data, total },
+    };
+    packed_batches++;
+    int ret = emmc_write_run(e[0].sector, (total + 1) | CMD23_PACKED, 0, sg, 2, total + 1);
+    if (ret == 0) ret = emmc_write_sync();
+
+    if (msdc_poll_card_status() != 0) return -1;
+    if (ret == 0 && !(msdc[SDC_RESP0] & (R1_ERRORS | R1_EXCEPTION_EVENT))) return 0;
+
+    // The packed status bytes are dynamic, read them fresh, not from the cache
+    if (emmc_fetch_ext_csd(ext_csd_chk) != 0) return -1;
+    const uint8_t *sts = (const uint8_t *)ext_csd_chk;
+    if (sts[EXT_CSD_PACKED_CMD_STATUS] & EXT_CSD_PACKED_STS_ERROR) {
+        if (sts[EXT_CSD_PACKED_CMD_STATUS] & EXT_CSD_PACKED_STS_INDEXED) {
+            *fail_index = sts[EXT_CSD_PACKED_FAILURE_INDEX];
+        }
+        printf("Packed write failed, entry %d\n", *fail_index);
+        return -1;
+    }
+    if (ret != 0) return -1;
+
+    printf("Packed write status error\n");
+    printf("RESP0 0x%s\n", u32_to_str(msdc[SDC_RESP0]));
+    return -1;
+}
+
+// Queue depth from EXT_CSD, 0 when the card has no command queue
+uint32_t emmc_cmdq_depth(void) {
+    const uint8_t *ext_csd = emmc_ext_csd();
+    if (ext_csd == NULL || !(ext_csd[EXT_CSD_CMDQ_SUPPORT] & 1)) return 0;
+    return (ext_csd[EXT_CSD_CMDQ_DEPTH] & 0x1F) + 1;
+}
+
+// Queue t[0..n-1] as task ids 0..n-1 with CMD44/CMD45. All tasks go the
+// same direction: a read queued behind a write could hit the stale-data
+// case, and the discard read that covers it is a legacy command.
+int emmc_cmdq_queue(uint32_t partition, const struct emmc_cmdq_task *t, uint32_t n) {
+    if (n == 0 || n > emmc_cmdq_depth()) return -1;
+    for (uint32_t i = 0; i < n; i++) {
+        if (t[i].write != t[0].write) return -1;
+        if (t[i].num_sectors == 0 || t[i].num_sectors > 0xFFFF) return -1;
+    }
+
+    if (partition != current_partition) {
+        if (cmdq_on && emmc_cmdq_set(0) != 0) return -1;
+        if (emmc_set_partition(partition) != 0) return -1;
+    }
+
+    if (!t[0].write && msdc_read_stale()) {
+        if (cmdq_on && emmc_cmdq_set(0) != 0) return -1;
+        if (msdc_wait_card_ready() != 0) return -1;
+        discard_reads++;
+        if (emmc_read_single(17, t[0].sector, discard_blk) != 0) return -1;
+    }
+
+    if (msdc_wait_card_ready() != 0) {
+        printf("Card not ready before queueing\n");
+        return -1;
+    }
+    if (!cmdq_on && emmc_cmdq_set(1) != 0) return -1;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t params = CMDQ_TASK_ID(i) | t[i].num_sectors | (t[i].write ? 0 : CMDQ_TASK_READ);
+        if (msdc_send_cmd(44, params, CMD_R1_RESP) != 0 || (msdc[SDC_RESP0] & R1_ERRORS) ||
+            msdc_send_cmd(45, t[i].sector, CMD_R1_RESP) != 0 || (msdc[SDC_RESP0] & R1_ERRORS)) {
+            printf("Queueing task %d failed\n", i);
+            printf("RESP0 0x%s\n", u32_to_str(msdc[SDC_RESP0]));
+            emmc_cmdq_discard();
             return -1;
         }
+    }
+    return 0;
+}
 
-        // Wait for data to start arriving
-        uint32_t timeout_val = 100000;
-        while (timeout_val-- > 0) {
-            if ((msdc[MSDC_FIFOCS] & 0xFF) > 0) break;
-            if (msdc[MSDC_INT] & INT_DATA_BITS) break;
+// CMD13 with SQS set returns the queue status register: one bit per
+// task the card has ready to execute. Picks the lowest of `pending`.
+int emmc_cmdq_next(uint32_t pending, uint32_t *id) {
+    uint32_t start = timer_ticks();
+    uint32_t limit = timer_us_to_ticks(MSDC_CMDQ_TIMEOUT_US);
+    while (timer_ticks() - start < limit) {
+        if (msdc_send_cmd(13, 0x00010000 | CMD13_SQS, CMD_R1_RESP) != 0) break;
+        uint32_t qsr = msdc[SDC_RESP0] & pending;
+        if (qsr) {
+            *id = __builtin_ctz(qsr);
+            return 0;
         }
+        udelay(MSDC_CMDQ_POLL_US);
+    }
+    printf("No queued task ready\n");
+    return -1;
+}
 
-        // Read 128 words (512 bytes) from FIFO
-        int words_read = 0;
-        timeout_val = 100000;
+// CMD46/CMD47 for a ready task, then its data phase. Closed-ended, the
+// card already knows the length from CMD44.
+int emmc_cmdq_exec(const struct emmc_cmdq_task *t, uint32_t id) {
+    uint32_t n = t->num_sectors;
+    uint8_t cmd = t->write ? 47 : 46;
 
-        while (timeout_val-- > 0 && words_read < 128) {
-            uint32_t fifo_count = msdc[MSDC_FIFOCS] & 0xFF;
-            while (fifo_count >= 4 && words_read < 128) {
-                buf32[words_read++] = msdc[MSDC_RXDATA];
-                fifo_count = msdc[MSDC_FIFOCS] & 0xFF;
-            }
-            if (msdc[MSDC_INT] & INT_XFER_COMPL) break;
+    if (t->write) {
+        msdc_clear_fifo();
+        msdc[MSDC_INT] = 0xFFFFFFFF;
+        msdc_state.write_done = 1;
+    } else {
+        msdc_drain_rxdata_fifo();
+    }
+    msdc[SDC_BLK_NUM] = n;
+
+    uint32_t flags = CMD_R1_RESP | CMD_BLKLEN(512) | (n > 1 ? CMD_MULTI_BLK : CMD_SINGLE_BLK) |
+                     (t->write ? CMD_WRITE : 0);
+    if (msdc_send_cmd(cmd, CMDQ_TASK_ID(id), flags) != 0 || (msdc[SDC_RESP0] & R1_ERRORS)) {
+        printf("CMD%d task %d failed\n", cmd, id);
+        printf("RESP0 0x%s\n", u32_to_str(msdc[SDC_RESP0]));
+        msdc[SDC_BLK_NUM] = 1;
+        card_state = CARD_STATE_UNKNOWN;
+        return -1;
+    }
+    msdc[MSDC_INT] = INT_CMDRDY;
+    cmdq_tasks++;
+
+    struct emmc_sg sg = { t->buf, n };
+    int xfer_failed = msdc_data_xfer(&sg, 1, t->write);
+    msdc_wait_int(INT_XFER_COMPL | INT_DATCRCERR | INT_DATTMO, t->write ? MSDC_WRITE_TIMEOUT_US : 100000);
+
+    uint32_t int_status = msdc[MSDC_INT];
+    msdc[MSDC_INT] = int_status;
+    msdc[SDC_BLK_NUM] = 1;
+
+    if (xfer_failed || (int_status & (INT_DATCRCERR | INT_DATTMO)) || !(int_status & INT_XFER_COMPL)) {
+        printf("CMD%d task data error\n", cmd);
+        printf("INT 0x%s\n", u32_to_str(int_status));
+        if (!t->write) {
+            msdc_drain_rxdata_fifo();
+            msdc_state.fifo_residue = 1;
         }
+        card_state = CARD_STATE_UNKNOWN;
+        return -1;
+    }
+
+    if (!t->write) {
+        msdc_read_done();
+        return 0;
+    }
+    card_state = CARD_STATE_BUSY;
+    if (msdc_wait_busy() != 0) {
+        printf("Card busy after queued write\n");
+        return -1;
+    }
+    return 0;
+}
+
+// CMD48 - CMDQ_TASK_MGMT, drop every queued task after an error
+int emmc_cmdq_discard(void) {
+    if (msdc_send_cmd(48, CMD48_DISCARD_QUEUE, CMD_R1B_RESP) != 0) return -1;
+    return msdc_wait_busy();
+}
+
+// One CMD35/CMD36/CMD38 sequence over [start, start + count). The
+// partition is already selected by the caller.
+static int emmc_erase_run(uint32_t start, uint32_t count, uint32_t arg, uint32_t timeout_ms) {
+    if (msdc_wait_card_ready() != 0) {
+        printf("Card not ready before erase\n");
+        return -1;
+    }
+
+    // CMD35/CMD36 - ERASE_GROUP_START/END, sector addresses
+    if (msdc_send_cmd(35, start, CMD_R1_RESP) != 0 || (msdc[SDC_RESP0] & R1_ERRORS)) {
+        printf("CMD35 failed\n");
+        printf("RESP0 0x%s\n", u32_to_str(msdc[SDC_RESP0]));
+        return -1;
+    }
+    if (msdc_send_cmd(36, start + count - 1, CMD_R1_RESP) != 0 || (msdc[SDC_RESP0] & R1_ERRORS)) {
+        printf("CMD36 failed\n");
+        printf("RESP0 0x%s\n", u32_to_str(msdc[SDC_RESP0]));
+        return -1;
+    }
+
+    // CMD38 - ERASE, the card holds DAT0 low until the range is cleared
+    msdc_state.write_done = 1;
+    if (msdc_send_cmd(38, arg, CMD_R1B_RESP) != 0) {
+        printf("CMD38 failed\n");
+        return -1;
+    }
+    if (msdc_wait_busy_ms(timeout_ms) != 0) {
+        printf("Erase busy timeout\n");
+        return -1;
+    }
 
-        uint32_t int_status = msdc[MSDC_INT];
-        msdc[MSDC_INT] = int_status;
+    // Erase sequence, parameter and write-protect skips show up in the status
+    if (msdc_poll_card_status() != 0) return -1;
+    if (msdc[SDC_RESP0] & (R1_ERRORS | R1_WP_ERASE_SKIP)) {
+        printf("Erase error in status\n");
+        printf("RESP0 0x%s\n", u32_to_str(msdc[SDC_RESP0]));
+        return -1;
+    }
+    return 0;
+}
 
-        if ((int_status & (INT_DATCRCERR | INT_DATTMO)) || words_read < 128) {
-            printf("EXT_CSD read failed!\n");
+// Split [start, end) into CMD38 runs of at most EMMC_ERASE_CHUNK_GROUPS
+// erase groups, each with the busy time the card advertises for it.
+static int emmc_erase_range(uint32_t start, uint32_t end, uint32_t arg, uint32_t grp, uint32_t group_ms) {
+    uint32_t chunk = EMMC_ERASE_CHUNK_GROUPS * grp;
+    while (start < end) {
+        uint32_t n = end - start;
+        if (n > chunk) n = chunk;
+        // An unaligned run can touch one more group than its length
+        uint32_t groups = (n + grp - 1) / grp + 1;
+        if (emmc_erase_run(start, n, arg, group_ms * groups + MSDC_BUSY_TIMEOUT_MS) != 0) {
+            printf("Erase failed at sector 0x%s\n", u32_to_str(start));
             return -1;
         }
+        start += n;
+    }
+    return 0;
+}
+
+// ERASE and SECURE work on whole erase groups. A normal erase handles
+// partial groups at either end with TRIM when the card supports it, a
+// secure erase must be aligned. TRIM and DISCARD take any sector range.
+int emmc_erase(uint32_t partition, uint32_t start, uint32_t count, uint32_t type) {
+    if (count == 0) return 0;
+    if (type != EMMC_ERASE_NORMAL && type != EMMC_ERASE_TRIM &&
+        type != EMMC_ERASE_DISCARD && type != EMMC_ERASE_SECURE) {
+        printf("Invalid erase type 0x%s\n", u32_to_str(type));
+        return -1;
+    }
+
+    // High-capacity erase groups, HC_ERASE_GRP_SIZE x 512 KiB
+    const uint8_t *ext_csd = emmc_ext_csd();
+    if (ext_csd == NULL) return -1;
+    if (!(ext_csd[EXT_CSD_ERASE_GROUP_DEF] & 1) && ext_csd[EXT_CSD_HC_ERASE_GRP_SIZE]) {
+        if (emmc_switch(EXT_CSD_ERASE_GROUP_DEF, 1) != 0) return -1;
+        ext_csd = emmc_ext_csd();
+        if (ext_csd == NULL) return -1;
+    }
+    uint32_t grp = ext_csd[EXT_CSD_HC_ERASE_GRP_SIZE] * 1024;
+    if (grp == 0) grp = 1;
+    uint8_t features = ext_csd[EXT_CSD_SEC_FEATURE_SUPPORT];
+
+    uint32_t mult = (type & EMMC_ERASE_TRIM) ? ext_csd[EXT_CSD_TRIM_MULT] : ext_csd[EXT_CSD_ERASE_TIMEOUT_MULT];
+    if (mult == 0) mult = 1;
+    if (type == EMMC_ERASE_SECURE) mult *= ext_csd[EXT_CSD_SEC_ERASE_MULT] ? ext_csd[EXT_CSD_SEC_ERASE_MULT] : 1;
+    uint32_t group_ms = mult * EMMC_ERASE_UNIT_MS;
+    uint32_t trim_ms = (ext_csd[EXT_CSD_TRIM_MULT] ? ext_csd[EXT_CSD_TRIM_MULT] : 1) * EMMC_ERASE_UNIT_MS;
+
+    if (type == EMMC_ERASE_SECURE && !(features & EXT_CSD_SEC_ER_EN)) {
+        printf("Secure erase not supported\n");
+        return -1;
+    }
+    if (type == EMMC_ERASE_TRIM && !(features & EXT_CSD_SEC_GB_CL_EN)) {
+        printf("TRIM not supported\n");
+        return -1;
+    }
+    // DISCARD came with eMMC 4.5 (EXT_CSD_REV 6), it has no feature bit
+    if (type == EMMC_ERASE_DISCARD && ext_csd[EXT_CSD_REV] < 6) {
+        printf("DISCARD not supported\n");
+        return -1;
+    }
+
+    if (emmc_switch_partition(partition) != 0) return -1;
+
+    uint32_t end = start + count;
+    if (end < start) return -1;
+    if (type != EMMC_ERASE_NORMAL && type != EMMC_ERASE_SECURE) {
+        return emmc_erase_range(start, end, type, grp, group_ms);
+    }
+
+    uint32_t head = (start + grp - 1) / grp * grp;
+    uint32_t tail = end / grp * grp;
+    if (head > end) head = end;
+    if (tail < head) tail = head;
 
-        // Wait for card ready before next attempt or return
-        if (msdc_wait_card_ready() != 0) {
-            printf("Card not ready after EXT_CSD read\n");
+    if (head != start || tail != end) {
+        if (type == EMMC_ERASE_SECURE || !(features & EXT_CSD_SEC_GB_CL_EN)) {
+            printf("Erase range not aligned to 0x%s sectors\n", u32_to_str(grp));
             return -1;
         }
+        if (head > start && emmc_erase_range(start, head, EMMC_ERASE_TRIM, grp, trim_ms) != 0) return -1;
+        if (end > tail && emmc_erase_range(tail, end, EMMC_ERASE_TRIM, grp, trim_ms) != 0) return -1;
+    }
+    return emmc_erase_range(head, tail, type, grp, group_ms);
+}
+
+// Served from the EXT_CSD cache, the card is only read when one of
+// our CMD6 switches has invalidated it.
+int emmc_read_ext_csd(uint8_t *buffer) {
+    const uint8_t *ext_csd = emmc_ext_csd();
 
-        // First iteration is dummy read, discard and read again
-	    emmc_init();
-	    msdc[MSDC_CFG] |= 0xF;
-	    for (int retry = 5000; retry > 0; retry--) {
-		if ((msdc[MSDC_CFG] & 0x4) == 0) break;
-	    }
-     }
+    if (ext_csd == NULL) {
+        printf("EXT_CSD read failed!\n");
+        return -1;
+    }
 
+    memcpy(buffer, ext_csd, 512);
     return 0;
 }
 
@@ -546,6 +2438,7 @@ void print_hex_byte(uint8_t b) {
 void emmc_boot0_verify_test(void) {
     uint32_t block0[128];
     uint32_t block1[128];
+    uint32_t multi[256];
     
     printf("\n=== Boot0 Read Verification Test ===\n");
     
@@ -565,6 +2458,34 @@ void emmc_boot0_verify_test(void) {
         return;
     }
     
+    // Read both blocks again with one CMD18
+    printf("[3] Reading boot0 blocks 0-1 with CMD18...\n");
+    if (emmc_read_multi_sector(EMMC_PART_BOOT0, 0, 2, (uint8_t *)multi) != 0) {
+        printf("FAILED: Could not multi-read boot0 blocks 0-1\n");
+        return;
+    }
+    if (!buffers_equal(block0, &multi[0], 128) || !buffers_equal(block1, &multi[128], 128)) {
+        printf("FAILED: CMD18 data differs from CMD17 data!\n");
+        return;
+    }
+    printf("CMD18 data matches CMD17 data\n");
+
+    // Same blocks into two non-contiguous segments, in swapped order
+    printf("[4] Reading boot0 blocks 0-1 scatter-gather...\n");
+    struct emmc_sg sg[2] = {
+        { (uint8_t *)&multi[128], 1 },
+        { (uint8_t *)&multi[0], 1 },
+    };
+    if (emmc_read_sg(EMMC_PART_BOOT0, 0, sg, 2) != 0) {
+        printf("FAILED: Could not scatter-read boot0 blocks 0-1\n");
+        return;
+    }
+    if (!buffers_equal(block0, &multi[128], 128) || !buffers_equal(block1, &multi[0], 128)) {
+        printf("FAILED: Scatter-gather data differs from CMD17 data!\n");
+        return;
+    }
+    printf("Scatter-gather data matches CMD17 data\n");
+
     // Dump block 0
     printf("\n=== Boot0 Block 0 (512 bytes) ===\n");
     uint8_t *b0 = (uint8_t *)block0;
@@ -6,20 +6,128 @@
 #define EMMC_PART_BOOT0   1
 #define EMMC_PART_BOOT1   2
 
+// Data transfer modes for multi-block transfers (values match mt_sd.h MSDC_MODE_*)
+#define EMMC_XFER_PIO         1
+#define EMMC_XFER_DMA_BASIC   2
+#define EMMC_XFER_DMA_DESC    3
+
+// Bus timing modes
+#define EMMC_TIMING_LEGACY    0
+#define EMMC_TIMING_HS        1
+#define EMMC_TIMING_DDR52     2
+#define EMMC_TIMING_HS200     3
+#define EMMC_TIMING_HS400     4
+#define EMMC_TIMING_HS400ES   5
+
+// Auto commands the controller may add around multi-block transfers (flags)
+#define EMMC_AUTO_CMD_NONE    0
+#define EMMC_AUTO_CMD12       1
+#define EMMC_AUTO_CMD23       2
+
+// CMD38 arguments for emmc_erase
+#define EMMC_ERASE_NORMAL     0x00000000
+#define EMMC_ERASE_TRIM       0x00000001
+#define EMMC_ERASE_DISCARD    0x00000003
+#define EMMC_ERASE_SECURE     0x80000000
+
+// Receive delays found by HS200/HS400 tuning, reusable across sessions
+struct emmc_tuning {
+    uint32_t valid;
+    uint32_t timing;
+    uint32_t cmd_dly;    // PAD_TUNE0 CMDRDLY
+    uint32_t dat_dly;    // PAD_TUNE0 DATRRDLY
+    uint32_t ds_dly;     // PAD_DS_TUNE DLY1, HS400 only
+};
+
+// One segment of a scatter-gather transfer
+struct emmc_sg {
+    uint8_t *buf;
+    uint32_t num_sectors;
+};
+
+// One write of a packed batch (emmc_write_packed). The entries' data lies
+// back to back in a single buffer, in entry order.
+struct emmc_packed_entry {
+    uint32_t sector;
+    uint32_t num_sectors;
+};
+
+// Entries a 512-byte packed header can describe
+#define EMMC_PACKED_MAX_ENTRIES 63
+
+// One task of a command queue batch
+struct emmc_cmdq_task {
+    uint32_t write;
+    uint32_t sector;
+    uint32_t num_sectors;
+    uint8_t *buf;
+};
+
+// Task ids the queue status register can report
+#define EMMC_CMDQ_MAX_TASKS 32
+
+// Driver counters, reported over USB by command 0x1008
+struct emmc_stats {
+    uint32_t discard_reads;     // throw-away reads issued for stale data
+    uint32_t cmd13_sent;        // CMD13 status polls sent
+    uint32_t cmd13_skipped;     // ready checks answered from tracked state
+    uint32_t ext_csd_hits;      // EXT_CSD requests served from the cache
+    uint32_t ext_csd_fetches;   // EXT_CSD reads from the card
+    uint32_t auto_cmd_sent;     // transfers closed by controller CMD12/CMD23
+    uint32_t auto_cmd_errors;   // auto commands with an error in their R1
+    uint32_t cache_flushes;     // FLUSH_CACHE switches issued
+    uint32_t packed_batches;    // packed CMD25 transfers sent
+    uint32_t cmdq_tasks;        // queued tasks executed (CMD46/CMD47)
+    uint32_t pipe_emmc_bound;   // emmc_read_wait found the DMA still running
+    uint32_t pipe_host_bound;   // emmc_read_wait found the DMA already done
+    uint32_t pipe_wait_ticks;   // timer ticks spent in emmc_read_wait
+    uint32_t busy_deferred;     // writes that returned before programming ended
+};
+
 extern const char* u32_to_str(uint32_t v);
 int buffers_equal(uint32_t *a, uint32_t *b, int words);
 void msdc_wait_cmd_ready(void);
 void msdc_clear_fifo(void);
-int msdc_wait_int(uint32_t mask, uint32_t timeout_val);
+int msdc_wait_int(uint32_t mask, uint32_t timeout_us);
 int msdc_send_cmd(uint8_t cmd_idx, uint32_t arg, uint32_t flags);
 int msdc_wait_card_ready(void); 
 
+int emmc_set_xfer_mode(uint32_t mode);
+uint32_t emmc_get_xfer_mode(void);
+int emmc_set_auto_cmd(uint32_t flags);
+uint32_t emmc_get_auto_cmd(void);
+
+void emmc_get_stats(struct emmc_stats *st);
+uint32_t emmc_get_bus_clock(void);
+uint32_t emmc_get_timing(void);
+int emmc_set_max_timing(uint32_t t);
+uint32_t emmc_get_max_timing(void);
+void emmc_get_tuning(struct emmc_tuning *t);
+void emmc_set_tuning(const struct emmc_tuning *t);
+
 void emmc_init(void);
 int emmc_switch_partition(uint32_t partition);
 int emmc_read_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer);
 int emmc_write_sector(uint32_t partition, uint32_t sector_num, uint32_t *buffer);
 int emmc_read_ext_csd(uint8_t *buffer);
 int emmc_read_multi_sector(uint32_t partition, uint32_t start_sector, uint32_t num_sectors, uint8_t *buffer);
+int emmc_write_sync(void);
+int emmc_write_multi_sector(uint32_t partition, uint32_t start_sector, uint32_t num_sectors, uint8_t *buffer, int reliable);
+int emmc_read_sg(uint32_t partition, uint32_t start_sector, const struct emmc_sg *sg, uint32_t nsg);
+int emmc_read_async(uint32_t partition, uint32_t start_sector, uint32_t num_sectors, uint8_t *buffer);
+int emmc_read_wait(void);
+int emmc_write_sg(uint32_t partition, uint32_t start_sector, const struct emmc_sg *sg, uint32_t nsg, int reliable);
+int emmc_set_cache(uint32_t enable);
+uint32_t emmc_get_cache(void);
+int emmc_flush_cache(void);
+int emmc_write_packed(uint32_t partition, const struct emmc_packed_entry *e, uint32_t n,
+                      uint8_t *data, uint32_t *fail_index);
+uint32_t emmc_cmdq_depth(void);
+int emmc_cmdq_queue(uint32_t partition, const struct emmc_cmdq_task *t, uint32_t n);
+int emmc_cmdq_next(uint32_t pending, uint32_t *id);
+int emmc_cmdq_exec(const struct emmc_cmdq_task *t, uint32_t id);
+int emmc_cmdq_discard(void);
+int emmc_erase(uint32_t partition, uint32_t start, uint32_t count, uint32_t type);
 void emmc_roundtrip_test(void);
 void emmc_boot0_verify_test(void); 
 
@@ -0,0 +1,298 @@
+#include <stdint.h>
+
+#include "printf.h"
+#include "drivers/sleepy.h"
+#include "mt8113_usb.h"
+
+// Stage2-owned bulk I/O on the MUSB controller the BROM enumerated.
+// The BROM keeps EP0 and the descriptors it set up; we only take over
+// the two bulk endpoints of its CDC interface, in high-speed mode, and
+// move full packets with the controller's DMA. usbdl_put_data and
+// usbdl_get_data are swapped for these once musb_takeover succeeds.
+
+// Move whole packets by DMA, the rest by PIO
+#ifndef MUSB_USE_DMA
+#define MUSB_USE_DMA            1
+#endif
+
+#define MUSB_TX_TIMEOUT_US      (5000000)
+#define MUSB_RX_TIMEOUT_US      (5000000)
+
+// Common registers (byte offsets, 8/16 bit wide)
+#define MUSB_POWER              0x01
+#define MUSB_INDEX              0x0E
+#define MUSB_FIFO(ep)           (0x20 + (ep) * 4)
+
+// Indexed endpoint registers, valid for the endpoint in MUSB_INDEX
+#define MUSB_TXMAXP             0x10
+#define MUSB_TXCSR              0x12
+#define MUSB_RXMAXP             0x14
+#define MUSB_RXCSR              0x16
+#define MUSB_RXCOUNT            0x18
+
+// HSDMA channel registers
+#define MUSB_DMA_INTR           0x200
+#define MUSB_DMA_CNTL(ch)       (0x204 + (ch) * 0x10)
+#define MUSB_DMA_ADDR(ch)       (0x208 + (ch) * 0x10)
+#define MUSB_DMA_COUNT(ch)      (0x20C + (ch) * 0x10)
+
+#define MUSB_DMA_CH_TX          0
+#define MUSB_DMA_CH_RX          1
+
+// POWER bits
+#define MUSB_POWER_HSMODE       (1 << 4)
+
+// TXCSR bits (peripheral mode)
+#define MUSB_TXCSR_TXPKTRDY     (1 << 0)
+#define MUSB_TXCSR_DMAMODE      (1 << 10)
+#define MUSB_TXCSR_DMAENAB      (1 << 12)
+#define MUSB_TXCSR_AUTOSET      (1 << 15)
+
+// RXCSR bits (peripheral mode)
+#define MUSB_RXCSR_RXPKTRDY     (1 << 0)
+#define MUSB_RXCSR_DMAMODE      (1 << 11)
+#define MUSB_RXCSR_DMAENAB      (1 << 13)
+#define MUSB_RXCSR_AUTOCLEAR    (1 << 15)
+
+// DMA_CNTL bits
+#define MUSB_DMA_ENABLE         (1 << 0)
+#define MUSB_DMA_DIR_TX         (1 << 1)
+#define MUSB_DMA_MODE1          (1 << 2)
+#define MUSB_DMA_EP(ep)         ((ep) << 4)
+#define MUSB_DMA_BUSERR         (1 << 8)
+#define MUSB_DMA_BURST_INCR16   (3 << 9)
+
+#define musb8(off)  (*(volatile uint8_t *)(MUSB_BASE + (off)))
+#define musb16(off) (*(volatile uint16_t *)(MUSB_BASE + (off)))
+#define musb32(off) (*(volatile uint32_t *)(MUSB_BASE + (off)))
+
+static uint32_t musb_on;
+static uint32_t maxp_in;
+static uint32_t maxp_out;
+
+// A packet longer than the caller asked for, handed out by later reads
+static uint8_t rx_pkt[512] __attribute__((aligned(4)));
+static uint32_t rx_pos;
+static uint32_t rx_len;
+
+static void musb_fifo_write(uint32_t ep, const uint8_t *p, uint32_t n) {
+    uint32_t i = 0;
+    if (!((uint32_t)p & 3)) {
+        for (; i + 4 <= n; i += 4) musb32(MUSB_FIFO(ep)) = *(const uint32_t *)&p[i];
+    }
+    for (; i < n; i++) musb8(MUSB_FIFO(ep)) = p[i];
+}
+
+static void musb_fifo_read(uint32_t ep, uint8_t *p, uint32_t n) {
+    uint32_t i = 0;
+    if (!((uint32_t)p & 3)) {
+        for (; i + 4 <= n; i += 4) *(uint32_t *)&p[i] = musb32(MUSB_FIFO(ep));
+    }
+    for (; i < n; i++) p[i] = musb8(MUSB_FIFO(ep));
+}
+
+// Wait for the TX FIFO to take another packet (the host has to read)
+static int musb_tx_wait(void) {
+    uint32_t start = timer_ticks();
+    uint32_t limit = timer_us_to_ticks(MUSB_TX_TIMEOUT_US);
+    while (musb16(MUSB_TXCSR) & MUSB_TXCSR_TXPKTRDY) {
+        if (timer_ticks() - start >= limit) {
+            printf("USB IN timeout\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void musb_dma_start(uint32_t ch, uint32_t ep, const void *buf, uint32_t len, uint32_t dir) {
+    musb32(MUSB_DMA_ADDR(ch)) = (uint32_t)buf;
+    musb32(MUSB_DMA_COUNT(ch)) = len;
+    asm volatile ("dsb" ::: "memory");
+    musb16(MUSB_DMA_CNTL(ch)) = MUSB_DMA_ENABLE | dir | MUSB_DMA_MODE1 | MUSB_DMA_EP(ep) | MUSB_DMA_BURST_INCR16;
+}
+
+// Channel interrupt bit is write-1-to-clear on MediaTek's HSDMA
+static int musb_dma_done(uint32_t ch) {
+    if (!(musb8(MUSB_DMA_INTR) & (1 << ch))) return 0;
+    musb8(MUSB_DMA_INTR) = 1 << ch;
+    return 1;
+}
+
+static void musb_dma_stop(uint32_t ch) {
+    musb16(MUSB_DMA_CNTL(ch)) = 0;
+    musb_dma_done(ch);
+    asm volatile ("dsb" ::: "memory");
+}
+
+// Full packets from buf straight into the IN FIFO, AUTOSET sends each
+static int musb_dma_tx(const uint8_t *buf, uint32_t len) {
+    if (musb_tx_wait() != 0) return -1;
+    musb16(MUSB_TXCSR) |= MUSB_TXCSR_AUTOSET | MUSB_TXCSR_DMAENAB | MUSB_TXCSR_DMAMODE;
+    musb_dma_start(MUSB_DMA_CH_TX, MUSB_EP_IN, buf, len, MUSB_DMA_DIR_TX);
+
+    int ret = -1;
+    uint32_t start = timer_ticks();
+    uint32_t limit = timer_us_to_ticks(MUSB_TX_TIMEOUT_US);
+    while (timer_ticks() - start < limit) {
+        if (musb_dma_done(MUSB_DMA_CH_TX)) {
+            ret = (musb16(MUSB_DMA_CNTL(MUSB_DMA_CH_TX)) & MUSB_DMA_BUSERR) ? -1 : 0;
+            break;
+        }
+    }
+    musb_dma_stop(MUSB_DMA_CH_TX);
+
+    // DMAENAB has to drop before DMAMODE
+    musb16(MUSB_TXCSR) &= ~(MUSB_TXCSR_AUTOSET | MUSB_TXCSR_DMAENAB);
+    musb16(MUSB_TXCSR) &= ~MUSB_TXCSR_DMAMODE;
+    if (ret != 0) printf("USB IN DMA failed\n");
+    return ret;
+}
+
+// Wait for an OUT packet, at most `limit` ticks (0: for good)
+static int musb_rx_wait(uint32_t limit) {
+    uint32_t start = timer_ticks();
+    while (!(musb16(MUSB_RXCSR) & MUSB_RXCSR_RXPKTRDY)) {
+        if (limit && timer_ticks() - start >= limit) {
+            printf("USB OUT timeout\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Full packets from the OUT FIFO into buf. A short packet doesn't raise
+// a DMA request, so stop there and report how far the DMA got. `limit`
+// bounds the wait for each packet like musb_rx_wait.
+static int musb_dma_rx(uint8_t *buf, uint32_t len, uint32_t limit, uint32_t *moved) {
+    musb16(MUSB_RXCSR) |= MUSB_RXCSR_AUTOCLEAR | MUSB_RXCSR_DMAENAB | MUSB_RXCSR_DMAMODE;
+    musb_dma_start(MUSB_DMA_CH_RX, MUSB_EP_OUT, buf, len, 0);
+
+    int ret = 0;
+    uint32_t addr = (uint32_t)buf;
+    uint32_t start = timer_ticks();
+    while (!musb_dma_done(MUSB_DMA_CH_RX)) {
+        if ((musb16(MUSB_RXCSR) & MUSB_RXCSR_RXPKTRDY) && musb16(MUSB_RXCOUNT) < maxp_out) break;
+        uint32_t now = musb32(MUSB_DMA_ADDR(MUSB_DMA_CH_RX));
+        if (now != addr) {
+            addr = now;
+            start = timer_ticks();
+            limit = timer_us_to_ticks(MUSB_RX_TIMEOUT_US);
+        } else if (limit && timer_ticks() - start >= limit) {
+            printf("USB OUT DMA timeout\n");
+            ret = -1;
+            break;
+        }
+    }
+    *moved = musb32(MUSB_DMA_ADDR(MUSB_DMA_CH_RX)) - (uint32_t)buf;
+    if (*moved > len) *moved = 0;
+    musb_dma_stop(MUSB_DMA_CH_RX);
+
+    musb16(MUSB_RXCSR) &= ~(MUSB_RXCSR_AUTOCLEAR | MUSB_RXCSR_DMAENAB);
+    musb16(MUSB_RXCSR) &= ~MUSB_RXCSR_DMAMODE;
+    return ret;
+}
+
+int musb_put_data(const void *buf, uint32_t len) {
+    const uint8_t *p = (const uint8_t *)buf;
+    musb8(MUSB_INDEX) = MUSB_EP_IN;
+
+    uint32_t bulk = len & ~(maxp_in - 1);
+    if (MUSB_USE_DMA && bulk && !((uint32_t)p & 3)) {
+        if (musb_dma_tx(p, bulk) != 0) return -1;
+        p += bulk;
+        len -= bulk;
+    }
+
+    while (len) {
+        uint32_t n = (len < maxp_in) ? len : maxp_in;
+        if (musb_tx_wait() != 0) return -1;
+        musb_fifo_write(MUSB_EP_IN, p, n);
+        musb16(MUSB_TXCSR) |= MUSB_TXCSR_TXPKTRDY;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Blocks until len bytes arrived, like the BROM routine it replaces.
+// `timeout` (ms) bounds the wait for the first packet, 0 waits for good
+// as the idle wait for a command needs. Once data is flowing the host is
+// mid-transfer, and each further packet gets MUSB_RX_TIMEOUT_US.
+int musb_get_data(void *buf, uint32_t len, uint32_t timeout) {
+    uint8_t *p = (uint8_t *)buf;
+    uint32_t limit = timeout ? timer_us_to_ticks(timeout * 1000) : 0;
+
+    while (len) {
+        if (rx_pos < rx_len) {
+            uint32_t n = rx_len - rx_pos;
+            if (n > len) n = len;
+            for (uint32_t i = 0; i < n; i++) p[i] = rx_pkt[rx_pos + i];
+            rx_pos += n;
+            p += n;
+            len -= n;
+            limit = timer_us_to_ticks(MUSB_RX_TIMEOUT_US);
+            continue;
+        }
+
+        musb8(MUSB_INDEX) = MUSB_EP_OUT;
+        uint32_t bulk = len & ~(maxp_out - 1);
+        if (MUSB_USE_DMA && bulk && !((uint32_t)p & 3)) {
+            uint32_t moved;
+            int ret = musb_dma_rx(p, bulk, limit, &moved);
+            p += moved;
+            len -= moved;
+            if (moved) limit = timer_us_to_ticks(MUSB_RX_TIMEOUT_US);
+            if (ret != 0) return -1;
+            if (moved == bulk) continue;
+        }
+
+        if (musb_rx_wait(limit) != 0) return -1;
+        limit = timer_us_to_ticks(MUSB_RX_TIMEOUT_US);
+        uint32_t count = musb16(MUSB_RXCOUNT);
+        if (count <= len) {
+            musb_fifo_read(MUSB_EP_OUT, p, count);
+            p += count;
+            len -= count;
+        } else {
+            musb_fifo_read(MUSB_EP_OUT, rx_pkt, count);
+            rx_pos = 0;
+            rx_len = count;
+        }
+        musb16(MUSB_RXCSR) &= ~MUSB_RXCSR_RXPKTRDY;
+    }
+    return 0;
+}
+
+// Check that the BROM left a high-speed link with 512-byte bulk
+// endpoints where we expect them, then own them from here on
+int musb_takeover(void) {
+    if (musb_on) return 0;
+
+    if (!(musb8(MUSB_POWER) & MUSB_POWER_HSMODE)) {
+        printf("USB link is not high-speed\n");
+        return -1;
+    }
+
+    musb8(MUSB_INDEX) = MUSB_EP_IN;
+    maxp_in = musb16(MUSB_TXMAXP) & 0x7FF;
+    musb8(MUSB_INDEX) = MUSB_EP_OUT;
+    maxp_out = musb16(MUSB_RXMAXP) & 0x7FF;
+    if (maxp_in != 512 || maxp_out != 512) {
+        printf("Unexpected bulk packet size %d\n", maxp_in);
+        printf("OUT packet size %d\n", maxp_out);
+        return -1;
+    }
+
+    // Let the BROM's last IN packet go out first
+    musb8(MUSB_INDEX) = MUSB_EP_IN;
+    if (musb_tx_wait() != 0) return -1;
+
+    rx_pos = 0;
+    rx_len = 0;
+    musb_on = 1;
+    return 0;
+}
+
+int musb_active(void) {
+    return musb_on;
+}
@@ -0,0 +1,25 @@
+#ifndef MT8113_USB_H
+#define MT8113_USB_H
+
+#include <stdint.h>
+
+// MUSB-style USB device controller. The base is the MT8516 usb0 address
+// and has not been confirmed on MT8113, so allow overriding at build time.
+#ifndef MUSB_BASE
+#define MUSB_BASE 0x11100000
+#endif
+
+// Bulk endpoints the BROM's CDC interface runs on
+#ifndef MUSB_EP_IN
+#define MUSB_EP_IN  1
+#endif
+#ifndef MUSB_EP_OUT
+#define MUSB_EP_OUT 1
+#endif
+
+int musb_takeover(void);
+int musb_active(void);
+int musb_put_data(const void *buf, uint32_t len);
+int musb_get_data(void *buf, uint32_t len, uint32_t timeout);
+
+#endif
@@ -4,14 +4,84 @@
 #include "printf.h"
 #include "libc.h"
 #include "drivers/sleepy.h"
+#include "drivers/irq.h"
 #include "mt8113_emmc.h"
+#include "mt8113_usb.h"
 
-// USB buffer length for usbdl_put_data chunks
-// Larger chunks = better throughput
+// Largest length handed to one usbdl_put_data/usbdl_get_data call.
+// Starts at USBDL_CHUNK_SIZE, the host may raise it with 0x1030 up to
+// USBDL_CHUNK_MAX. Larger chunks = better throughput
+#ifndef USBDL_CHUNK_SIZE
 #define USBDL_CHUNK_SIZE 256
+#endif
+#define USBDL_CHUNK_MIN 64
+// How long 0x1030 waits for the host to echo its test pattern
+#define USBDL_PROBE_TIMEOUT_MS 2000
+
+// Staging buffers for streamed range reads (0x1020): the card fills one
+// while the previous one goes out over USB. That takes a DMA xfer_mode,
+// in PIO mode emmc_read_async finishes each read before returning.
+#ifndef STAGE_BUF_COUNT
+#define STAGE_BUF_COUNT 2
+#endif
+#ifndef STAGE_BUF_SECTORS
+#define STAGE_BUF_SECTORS 32
+#endif
+#if STAGE_BUF_COUNT < 2
+#error "STAGE_BUF_COUNT must be at least 2"
+#endif
+
+#define STAGE_RING_SECTORS (STAGE_BUF_COUNT * STAGE_BUF_SECTORS)
+
+// Packed (0x1013), queued (0x1014) and streamed write (0x1021) batches.
+// Fixed, since the host sizes its batches to it. The staging ring shares
+// the memory, which only grows if the ring is configured larger.
+#define BATCH_BUF_SECTORS 64
+#define IO_BUF_SECTORS \
+    (STAGE_RING_SECTORS > BATCH_BUF_SECTORS ? STAGE_RING_SECTORS : BATCH_BUF_SECTORS)
+#define STAGE_BUF(i) (&batch_buf[(i) * STAGE_BUF_SECTORS * 0x200])
+
+// 0x1030 tries a unit on one batch buffer, so no unit can be larger
+#define USBDL_CHUNK_MAX (BATCH_BUF_SECTORS * 0x200)
 
 extern const char* u32_to_str(uint32_t v);
 
+static uint8_t batch_buf[IO_BUF_SECTORS * 0x200] __attribute__((aligned(64)));
+static uint32_t usb_chunk = USBDL_CHUNK_SIZE;
+
+static void usb_send(const uint8_t *buf, uint32_t len) {
+    for (uint32_t i = 0; i < len; i += usb_chunk) {
+        usbdl_put_data(&buf[i], (len - i < usb_chunk) ? len - i : usb_chunk);
+    }
+}
+
+// Receives are cut on sector boundaries so no call ends inside a
+// high-speed bulk packet. A timeout of 0 waits for good; otherwise a
+// nonzero return from usbdl_get_data (timeout or error) fails the lot.
+static int usb_recv_timeout(uint8_t *buf, uint32_t len, uint32_t timeout_ms) {
+    uint32_t step = (usb_chunk + 0x1FF) & ~0x1FF;
+    for (uint32_t i = 0; i < len; i += step) {
+        if (usbdl_get_data(&buf[i], (len - i < step) ? len - i : step, timeout_ms) != 0 && timeout_ms) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void usb_recv(uint8_t *buf, uint32_t len) {
+    usb_recv_timeout(buf, len, 0);
+}
+
+// Take a batch's write data. What doesn't fit is read and dropped, the
+// batch gets rejected but the stream stays in step.
+static void usb_recv_batch(uint32_t sectors) {
+    uint32_t fit = (sectors < BATCH_BUF_SECTORS) ? sectors : BATCH_BUF_SECTORS;
+    usb_recv(batch_buf, fit * 0x200);
+    for (uint32_t i = fit; i < sectors; i++) {
+        usbdl_get_data(batch_buf, 0x200, 0);
+    }
+}
+
 void recv_data(char *addr, uint32_t sz, uint32_t flags __attribute__((unused))) {
     for (uint32_t i = 0; i < (((sz + 3) & ~3) / 4); i++) {
         ((uint32_t *)addr)[i] = __builtin_bswap32(recv_dword());
@@ -67,6 +137,15 @@ int main() {
 
 //    while(1) {}
 
+    // Interrupts let the eMMC driver sleep in WFI, polling is the fallback
+    if (!IRQ_ENABLE) {
+        printf("IRQs off, polling\n");
+    } else if (irq_init() != 0) {
+        printf("IRQ setup failed, polling\n");
+    } else {
+        printf("IRQ ready\n");
+    }
+
     // Initialize eMMC before entering command loop
     emmc_init();
 
@@ -100,9 +179,7 @@ int main() {
                 printf("Read error!\n");
             } else {
                 //printf("Read succeeded, sending data...\n");
-                for (int i = 0; i < 0x200; i += USBDL_CHUNK_SIZE) {
-                    usbdl_put_data(&buf[i], USBDL_CHUNK_SIZE);
-                }
+                usb_send((uint8_t *)buf, 0x200);
             }
             break;
         }
@@ -111,7 +188,7 @@ int main() {
             uint32_t block = recv_dword();
             //printf("Write region 0x%s sector 0x%s\n", u32_to_str(region), u32_to_str(block));
             memset(buf, 0, sizeof(buf));
-            usbdl_get_data(buf, 0x200, 0);
+            usb_recv((uint8_t *)buf, 0x200);
             if (emmc_write_sector(region, block, (uint32_t*)buf) != 0) {
                 printf("Write error!\n");
             } else {
@@ -132,13 +209,359 @@ int main() {
             }
 
             printf("Read succeeded, sending data...\n");
-            for (int i = 0; i < 0x200; i += USBDL_CHUNK_SIZE) {
-                usbdl_put_data(&ext_csd[i], USBDL_CHUNK_SIZE);
+            usb_send(ext_csd, 0x200);
+            break;
+        }
+        case 0x1004: {
+            // Select PIO or DMA for multi-block transfers
+            uint32_t mode = recv_dword();
+            if (emmc_set_xfer_mode(mode) != 0) {
+                printf("Invalid transfer mode 0x%s\n", u32_to_str(mode));
+                send_dword(0xE0E0E0E0);
+            } else {
+                send_dword(0xD0D0D0D0);
+            }
+            break;
+        }
+        case 0x1005: {
+            // Report tuning taps (valid, timing, cmd_dly, dat_dly, ds_dly)
+            struct emmc_tuning t;
+            emmc_get_tuning(&t);
+            send_dword(t.valid);
+            send_dword(t.timing);
+            send_dword(t.cmd_dly);
+            send_dword(t.dat_dly);
+            send_dword(t.ds_dly);
+            break;
+        }
+        case 0x1006: {
+            // Load saved tuning taps, used by the next init (0x1000)
+            struct emmc_tuning t;
+            t.valid = recv_dword();
+            t.timing = recv_dword();
+            t.cmd_dly = recv_dword();
+            t.dat_dly = recv_dword();
+            t.ds_dly = recv_dword();
+            emmc_set_tuning(&t);
+            send_dword(0xD0D0D0D0);
+            break;
+        }
+        case 0x1007: {
+            // Cap the bus timing chosen by the next init (0x1000)
+            uint32_t max_timing = recv_dword();
+            if (emmc_set_max_timing(max_timing) != 0) {
+                printf("Invalid timing 0x%s\n", u32_to_str(max_timing));
+                send_dword(0xE0E0E0E0);
+            } else {
+                send_dword(0xD0D0D0D0);
+            }
+            break;
+        }
+        case 0x1008: {
+            // Driver counters: word count, then one word per field
+            struct emmc_stats st;
+            emmc_get_stats(&st);
+            send_dword(sizeof(st) / 4);
+            for (uint32_t i = 0; i < sizeof(st) / 4; i++) {
+                send_dword(((uint32_t *)&st)[i]);
+            }
+            break;
+        }
+        case 0x1009: {
+            // Auto CMD12/CMD23 flags for multi-block transfers
+            uint32_t flags = recv_dword();
+            if (emmc_set_auto_cmd(flags) != 0) {
+                printf("Invalid auto command flags 0x%s\n", u32_to_str(flags));
+                send_dword(0xE0E0E0E0);
+            } else {
+                send_dword(0xD0D0D0D0);
+            }
+            break;
+        }
+        case 0x1010: {
+            // Erase/trim/discard a sector range, status word when done
+            uint32_t region = recv_dword();
+            uint32_t start = recv_dword();
+            uint32_t count = recv_dword();
+            uint32_t type = recv_dword();
+            printf("Erase region 0x%s ", u32_to_str(region));
+            printf("start 0x%s ", u32_to_str(start));
+            printf("count 0x%s\n", u32_to_str(count));
+            if (emmc_erase(region, start, count, type) != 0) {
+                printf("Erase error!\n");
+                send_dword(0xE0E0E0E0);
+            } else {
+                send_dword(0xD0D0D0D0);
+            }
+            break;
+        }
+        case 0x1011: {
+            // Enable/disable the card's volatile write cache
+            uint32_t enable = recv_dword();
+            if (emmc_set_cache(enable) != 0) {
+                printf("Cache control failed\n");
+                send_dword(0xE0E0E0E0);
+            } else {
+                send_dword(0xD0D0D0D0);
+            }
+            break;
+        }
+        case 0x1012: {
+            // Make cached writes durable
+            if (emmc_flush_cache() != 0) {
+                send_dword(0xE0E0E0E0);
+            } else {
+                send_dword(0xD0D0D0D0);
+            }
+            break;
+        }
+        case 0x1013: {
+            // Packed write: region, entry count, (sector, count) per entry,
+            // then every entry's data. Replies status and failing entry.
+            struct emmc_packed_entry entries[EMMC_PACKED_MAX_ENTRIES];
+            uint32_t region = recv_dword();
+            uint32_t n = recv_dword();
+            uint32_t total = 0;
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t sector = recv_dword();
+                uint32_t count = recv_dword();
+                if (i < EMMC_PACKED_MAX_ENTRIES) {
+                    entries[i].sector = sector;
+                    entries[i].num_sectors = count;
+                }
+                total += count;
+            }
+            usb_recv_batch(total);
+            uint32_t fail_index = 0;
+            if (n > EMMC_PACKED_MAX_ENTRIES || total > BATCH_BUF_SECTORS) {
+                printf("Packed batch too large\n");
+                send_dword(0xE0E0E0E0);
+            } else if (emmc_write_packed(region, entries, n, batch_buf, &fail_index) != 0) {
+                printf("Packed write error!\n");
+                send_dword(0xE0E0E0E0);
+            } else {
+                send_dword(0xD0D0D0D0);
+            }
+            send_dword(fail_index);
+            break;
+        }
+        case 0x1014: {
+            // Queued batch: region, task count, (flags, sector, count) per
+            // task with flags bit0 = write, then the write data. Each read
+            // task replies its index and data in completion order. Ends with
+            // 0xFFFFFFFF, status and failing task + 1.
+            struct emmc_cmdq_task tasks[EMMC_CMDQ_MAX_TASKS];
+            uint32_t region = recv_dword();
+            uint32_t n = recv_dword();
+            uint32_t total = 0;
+            uint32_t write = 0;
+            int valid = (n > 0 && n <= EMMC_CMDQ_MAX_TASKS);
+            for (uint32_t i = 0; i < n; i++) {
+                uint32_t flags = recv_dword();
+                uint32_t sector = recv_dword();
+                uint32_t count = recv_dword();
+                if (i == 0) write = flags & 1;
+                if ((flags & 1) != write || count == 0 || count > BATCH_BUF_SECTORS) valid = 0;
+                if (i < EMMC_CMDQ_MAX_TASKS) {
+                    tasks[i].write = flags & 1;
+                    tasks[i].sector = sector;
+                    tasks[i].num_sectors = count;
+                    tasks[i].buf = write ? &batch_buf[total * 0x200] : batch_buf;
+                }
+                total += count;
+            }
+            if (write) {
+                usb_recv_batch(total);
+                if (total > BATCH_BUF_SECTORS) valid = 0;
+            }
+            uint32_t fail = 0;
+            int ok = 0;
+            if (!valid) {
+                printf("Queued batch rejected\n");
+            } else if (emmc_cmdq_depth() >= n && emmc_cmdq_queue(region, tasks, n) == 0) {
+                // Run tasks in whatever order the card reports them ready
+                uint32_t pending = (n == 32) ? 0xFFFFFFFF : ((1u << n) - 1);
+                uint32_t id = 0;
+                ok = 1;
+                while (pending) {
+                    int err = emmc_cmdq_next(pending, &id);
+                    // A stalled queue is blamed on its lowest pending task
+                    if (err != 0) id = __builtin_ctz(pending);
+                    else err = emmc_cmdq_exec(&tasks[id], id);
+                    if (err != 0) {
+                        printf("Queued task error!\n");
+                        fail = id + 1;
+                        emmc_cmdq_discard();
+                        ok = 0;
+                        break;
+                    }
+                    pending &= ~(1u << id);
+                    if (!write) {
+                        send_dword(id);
+                        usb_send(batch_buf, tasks[id].num_sectors * 0x200);
+                    }
+                }
+            } else {
+                // No command queue (or too shallow): same tasks, one by one
+                ok = 1;
+                for (uint32_t i = 0; i < n; i++) {
+                    int err = write ? (emmc_write_multi_sector(region, tasks[i].sector, tasks[i].num_sectors, tasks[i].buf, 0) ||
+                                       emmc_write_sync())
+                                    : emmc_read_multi_sector(region, tasks[i].sector, tasks[i].num_sectors, batch_buf);
+                    if (err != 0) {
+                        printf("Batch task error!\n");
+                        fail = i + 1;
+                        ok = 0;
+                        break;
+                    }
+                    if (!write) {
+                        send_dword(i);
+                        usb_send(batch_buf, tasks[i].num_sectors * 0x200);
+                    }
+                }
+            }
+            send_dword(0xFFFFFFFF);
+            send_dword(ok ? 0xD0D0D0D0 : 0xE0E0E0E0);
+            send_dword(fail);
+            break;
+        }
+        case 0x1020: {
+            // Range read: region, start, count. Streams count sectors back
+            // without further handshakes, then one status word. The read
+            // of the next stage buffer is started before the current one
+            // is sent. After an error the rest of the range is sent as
+            // zeros so the host's byte count still holds.
+            uint32_t region = recv_dword();
+            uint32_t start = recv_dword();
+            uint32_t count = recv_dword();
+            uint32_t stage = 0;
+            int ok = 1;
+            int pending = 0;
+            if (count > 0) {
+                uint32_t n = (count < STAGE_BUF_SECTORS) ? count : STAGE_BUF_SECTORS;
+                pending = emmc_read_async(region, start, n, STAGE_BUF(0)) == 0;
+            }
+            for (uint32_t done = 0; done < count;) {
+                uint32_t n = count - done;
+                if (n > STAGE_BUF_SECTORS) n = STAGE_BUF_SECTORS;
+                if (ok && (!pending || emmc_read_wait() != 0)) {
+                    printf("Range read error at 0x%s\n", u32_to_str(start + done));
+                    memset(batch_buf, 0, sizeof(batch_buf));
+                    ok = 0;
+                }
+                uint8_t *cur = ok ? STAGE_BUF(stage) : batch_buf;
+                uint32_t next = done + n;
+                stage = (stage + 1) % STAGE_BUF_COUNT;
+                pending = 0;
+                if (ok && next < count) {
+                    uint32_t m = count - next;
+                    if (m > STAGE_BUF_SECTORS) m = STAGE_BUF_SECTORS;
+                    pending = emmc_read_async(region, start + next, m, STAGE_BUF(stage)) == 0;
+                }
+                usb_send(cur, n * 0x200);
+                done = next;
+            }
+            send_dword(ok ? 0xD0D0D0D0 : 0xE0E0E0E0);
+            break;
+        }
+        case 0x1021: {
+            // Streaming write: region, start, count, ack interval (sectors,
+            // 0 = one staging buffer), then count sectors of data with no
+            // handshakes. Every interval, and at the end, the device sends
+            // 0xA0A0A0A0, the cumulative status and the first LBA of the
+            // chunk that failed (0xFFFFFFFF if none). After an error the
+            // rest of the data is taken and dropped so the stream stays in
+            // step. The card programs each chunk while the next one is
+            // received; its busy is only checked before the next write.
+            uint32_t region = recv_dword();
+            uint32_t start = recv_dword();
+            uint32_t count = recv_dword();
+            uint32_t interval = recv_dword();
+            if (interval == 0) interval = BATCH_BUF_SECTORS;
+            uint32_t fail_lba = 0xFFFFFFFF;
+            uint32_t since_ack = 0;
+            uint32_t prev = start;
+            for (uint32_t done = 0; done < count;) {
+                uint32_t n = count - done;
+                if (n > BATCH_BUF_SECTORS) n = BATCH_BUF_SECTORS;
+                if (n > interval - since_ack) n = interval - since_ack;
+                usb_recv(batch_buf, n * 0x200);
+                if (fail_lba == 0xFFFFFFFF && emmc_write_sync() != 0) {
+                    printf("Stream write error at 0x%s\n", u32_to_str(prev));
+                    fail_lba = prev;
+                }
+                if (fail_lba == 0xFFFFFFFF &&
+                    emmc_write_multi_sector(region, start + done, n, batch_buf, 0) != 0) {
+                    printf("Stream write error at 0x%s\n", u32_to_str(start + done));
+                    fail_lba = start + done;
+                }
+                prev = start + done;
+                done += n;
+                since_ack += n;
+                // The last ack has to cover the last chunk's programming
+                if (done == count && fail_lba == 0xFFFFFFFF && emmc_write_sync() != 0) {
+                    printf("Stream write error at 0x%s\n", u32_to_str(prev));
+                    fail_lba = prev;
+                }
+                if (since_ack == interval || done == count) {
+                    send_dword(0xA0A0A0A0);
+                    send_dword(fail_lba == 0xFFFFFFFF ? 0xD0D0D0D0 : 0xE0E0E0E0);
+                    send_dword(fail_lba);
+                    since_ack = 0;
+                }
+            }
+            break;
+        }
+        case 0x1030: {
+            // Session setup: the host asks for a transfer unit in bytes,
+            // the device clamps it and replies what it will try. A test
+            // pattern (rounded up to a sector) then goes out and has to
+            // come back intact and in time at that unit, else the previous
+            // one stays. The last reply is the unit in use.
+            uint32_t want = recv_dword();
+            uint32_t prev = usb_chunk;
+            if (want > USBDL_CHUNK_MAX) want = USBDL_CHUNK_MAX;
+            if (want < USBDL_CHUNK_MIN) want = USBDL_CHUNK_MIN;
+            want &= ~(USBDL_CHUNK_MIN - 1);
+            send_dword(want);
+
+            uint32_t len = (want + 0x1FF) & ~0x1FF;
+            for (uint32_t i = 0; i < len; i++) batch_buf[i] = (uint8_t)(i ^ (i >> 8));
+            usb_chunk = want;
+            usb_send(batch_buf, len);
+            memset(batch_buf, 0, len);
+            int ok = usb_recv_timeout(batch_buf, len, USBDL_PROBE_TIMEOUT_MS) == 0;
+            for (uint32_t i = 0; ok && i < len; i++) {
+                if (batch_buf[i] != (uint8_t)(i ^ (i >> 8))) ok = 0;
+            }
+            if (!ok) {
+                printf("USB chunk %d failed\n", want);
+                usb_chunk = prev;
+            }
+            printf("USB chunk %d bytes\n", usb_chunk);
+            send_dword(usb_chunk);
+            break;
+        }
+        case 0x1031: {
+            // Switch bulk I/O from the BROM routines to mt8113_usb.c. The
+            // reply still goes out the old way; on failure nothing changes.
+            int ret = musb_takeover();
+            send_dword(ret == 0 ? 0xD0D0D0D0 : 0xE0E0E0E0);
+            if (ret == 0) {
+                usbdl_put_data = musb_put_data;
+                usbdl_get_data = musb_get_data;
+                printf("Native USB driver active\n");
+            } else {
+                printf("USB takeover failed, staying on BROM routines\n");
             }
             break;
         }
         case 0x3000: {
             printf("Reboot\n");
+            // A watchdog reset drops whatever is still in the card's cache,
+            // or being programmed
+            if (emmc_write_sync() != 0) printf("Last write failed\n");
+            if (emmc_flush_cache() != 0) printf("Flush before reboot failed\n");
             volatile uint32_t *reg = (volatile uint32_t *)0x10007000;
             reg[8/4] = 0x1971;
             reg[0/4] = 0x22000014;
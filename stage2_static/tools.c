@@ -85,13 +85,13 @@ void send_dword(uint32_t value){
 
 uint32_t recv_dword(){
     uint32_t value;
-    usbdl_get_data(&value,4);
+    usbdl_get_data(&value,4,0);
     return __builtin_bswap32(value);
 }
 
 uint16_t recv_word(){
     uint16_t value;
-    usbdl_get_data(&value,2);
+    usbdl_get_data(&value,2,0);
     return __builtin_bswap16(value);
 }
 